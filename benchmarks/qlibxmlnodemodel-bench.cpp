@@ -0,0 +1,577 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+
+#include <QCoreApplication>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMap>
+#include <QPair>
+#include <QScopedPointer>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QVector>
+#include <QXmlQuery>
+#include <QXmlResultItems>
+#include <QtAlgorithms>
+
+#include "qlibxmlnodemodel.h"
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+// Version of the output format, bumped when results stop being comparable
+static const int FormatVersion = 1;
+
+// Model giving the benchmark access to the protected accessors
+class BenchModel : public QLibXmlNodeModel
+{
+public:
+    BenchModel(const QXmlNamePool &namePool, const QByteArray &source, const QUrl &uri, const ParseOptions &options)
+        : QLibXmlNodeModel(namePool, source, uri, options)
+    {
+    }
+
+    QXmlNodeModelIndex next(SimpleAxis axis, const QXmlNodeModelIndex &nodeIndex) const
+    {
+        return nextFromSimpleAxis(axis, nodeIndex);
+    }
+
+    QVector<QXmlNodeModelIndex> attributesOf(const QXmlNodeModelIndex &nodeIndex) const
+    {
+        return attributes(nodeIndex);
+    }
+};
+
+// Parameters of the run
+struct Config
+{
+    Config()
+        : depth(6), fanout(4), attributes(2), textSize(32), documents(4),
+          iterations(10), seed(1), freeze(false)
+    {
+    }
+
+    int depth;
+    int fanout;
+    int attributes;
+    int textSize;
+    int documents;
+    int iterations;
+    quint32 seed;
+    bool freeze;
+    QString corpus;
+    QString label;
+    QStringList queries;
+};
+
+// Random numbers which are the same on every platform, so synthetic
+// documents do not change between runs
+class Random
+{
+public:
+    Random(quint32 seed) : state(seed ? seed : 1) {}
+
+    quint32 next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    int bounded(int n)
+    {
+        return next() % n;
+    }
+
+private:
+    quint32 state;
+};
+
+// Timings of one benchmark, one sample per pass over a document
+struct Result
+{
+    Result() : bytes(0) {}
+
+    qint64 bytes;
+    QVector<qint64> nsecs;
+    QVector<qint64> ops;
+
+    void add(qint64 sampleNsecs, qint64 sampleOps)
+    {
+        nsecs.append(sampleNsecs);
+        ops.append(sampleOps);
+    }
+};
+
+static const char *const Tags[] = { "div", "p", "span", "a", "ul", "li", "td", "section" };
+static const int TagCount = sizeof(Tags) / sizeof(Tags[0]);
+
+static const char *const Words[] = { "lorem", "ipsum", "dolor", "sit", "amet", "&amp;", "caf\xc3\xa9", "\xd0\xbc\xd0\xb8\xd1\x80" };
+static const int WordCount = sizeof(Words) / sizeof(Words[0]);
+
+// Appends about size bytes of words
+static void appendText(QByteArray &out, Random &random, int size)
+{
+    int start = out.size();
+    while (out.size() - start < size) {
+        out += Words[random.bounded(WordCount)];
+        out += ' ';
+    }
+}
+
+static void appendElement(QByteArray &out, Random &random, const Config &config, int level, int &counter)
+{
+    const char *tag = Tags[random.bounded(TagCount)];
+    int id = counter++;
+
+    out += '<';
+    out += tag;
+    for (int i = 0; i < config.attributes; ++i) {
+        switch (i % 4) {
+            case 0:
+                out += " id=\"n" + QByteArray::number(id) + '"';
+                break;
+            case 1:
+                out += " class=\"c" + QByteArray::number(random.bounded(10)) + " c" + QByteArray::number(random.bounded(10)) + '"';
+                break;
+            case 2:
+                out += " href=\"/page/" + QByteArray::number(random.bounded(1000)) + '"';
+                break;
+            default:
+                out += " data-" + QByteArray::number(i) + "=\"" + QByteArray::number(random.next()) + '"';
+                break;
+        }
+    }
+    out += '>';
+
+    appendText(out, random, config.textSize);
+    if (level > 1) {
+        for (int i = 0; i < config.fanout; ++i) {
+            appendElement(out, random, config, level - 1, counter);
+        }
+    }
+
+    out += "</";
+    out += tag;
+    out += '>';
+}
+
+// Generates a HTML document, the same for the same config and seed
+static QByteArray generateDocument(const Config &config, quint32 seed)
+{
+    Random random(seed);
+    int counter = 0;
+
+    QByteArray out;
+    out += "<!DOCTYPE html>\n<html><head><title>";
+    appendText(out, random, config.textSize);
+    out += "</title></head><body>";
+    for (int i = 0; i < config.fanout; ++i) {
+        appendElement(out, random, config, config.depth, counter);
+    }
+    out += "</body></html>\n";
+    return out;
+}
+
+// Reads all HTML files below a directory, in a stable order
+static QList<QPair<QString, QByteArray> > readCorpus(const QString &path)
+{
+    QStringList fileNames;
+    QDirIterator it(path, QStringList() << "*.html" << "*.htm", QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        fileNames.append(it.next());
+    }
+    qSort(fileNames);
+
+    QList<QPair<QString, QByteArray> > documents;
+    for (int i = 0; i < fileNames.size(); ++i) {
+        QFile file(fileNames.at(i));
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning("Can't open %s, skipping", qPrintable(fileNames.at(i)));
+            continue;
+        }
+        documents.append(qMakePair(fileNames.at(i), file.readAll()));
+    }
+    return documents;
+}
+
+// Collects all nodes of a document in document order, attributes
+// right after their element
+static void collectNodes(const BenchModel &model, const QXmlNodeModelIndex &node, QVector<QXmlNodeModelIndex> *nodes, QVector<QXmlNodeModelIndex> *elements, QVector<QXmlNodeModelIndex> *attributes)
+{
+    nodes->append(node);
+    if (model.kind(node) == QXmlNodeModelIndex::Element) {
+        elements->append(node);
+        QVector<QXmlNodeModelIndex> attrs = model.attributesOf(node);
+        *nodes += attrs;
+        *attributes += attrs;
+    }
+
+    for (QXmlNodeModelIndex child = model.next(QAbstractXmlNodeModel::FirstChild, node); !child.isNull(); child = model.next(QAbstractXmlNodeModel::NextSibling, child)) {
+        collectNodes(model, child, nodes, elements, attributes);
+    }
+}
+
+// Keeps results of benchmarked calls alive, so they are not optimized out
+static volatile qint64 sink;
+
+static void benchAxis(const BenchModel &model, QAbstractXmlNodeModel::SimpleAxis axis, const QVector<QXmlNodeModelIndex> &nodes, Result *result)
+{
+    qint64 found = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < nodes.size(); ++i) {
+        found += !model.next(axis, nodes.at(i)).isNull();
+    }
+    result->add(timer.nsecsElapsed(), nodes.size());
+    sink += found;
+}
+
+static void benchDocument(const Config &config, const QXmlNamePool &namePool, const QString &uri, const QByteArray &source, QMap<QString, Result> *results)
+{
+    QLibXmlNodeModel::ParseOptions options;
+    options.flags |= QLibXmlNodeModel::SuppressErrors;
+    if (config.freeze) {
+        options.flags |= QLibXmlNodeModel::Freeze;
+    }
+
+    for (int iteration = 0; iteration < config.iterations; ++iteration) {
+        QElapsedTimer timer;
+
+        timer.start();
+        BenchModel model(namePool, source, QUrl(uri), options);
+        Result &parse = (*results)["parse"];
+        parse.add(timer.nsecsElapsed(), 1);
+        parse.bytes += source.size();
+
+        // Opening a snapshot of the document instead of parsing it again
+        QTemporaryFile snapshot;
+        if (snapshot.open() && model.saveSnapshot(&snapshot) && snapshot.flush()) {
+            timer.start();
+            QScopedPointer<QLibXmlNodeModel> opened(QLibXmlNodeModel::openSnapshot(namePool, snapshot.fileName()));
+            Result &open = (*results)["snapshot_open"];
+            open.add(timer.nsecsElapsed(), 1);
+            open.bytes += source.size();
+        }
+
+        QVector<QXmlNodeModelIndex> nodes;
+        QVector<QXmlNodeModelIndex> elements;
+        QVector<QXmlNodeModelIndex> attributes;
+        collectNodes(model, model.dom(), &nodes, &elements, &attributes);
+        if (nodes.isEmpty()) {
+            continue;
+        }
+
+        benchAxis(model, QAbstractXmlNodeModel::Parent, nodes, &(*results)["axis.parent"]);
+        benchAxis(model, QAbstractXmlNodeModel::FirstChild, nodes, &(*results)["axis.first_child"]);
+        benchAxis(model, QAbstractXmlNodeModel::PreviousSibling, nodes, &(*results)["axis.previous_sibling"]);
+        benchAxis(model, QAbstractXmlNodeModel::NextSibling, nodes, &(*results)["axis.next_sibling"]);
+
+        qint64 count = 0;
+        timer.start();
+        for (int i = 0; i < elements.size(); ++i) {
+            count += model.attributesOf(elements.at(i)).size();
+        }
+        (*results)["attributes"].add(timer.nsecsElapsed(), elements.size());
+
+        timer.start();
+        for (int i = 0; i < nodes.size(); ++i) {
+            count += model.kind(nodes.at(i));
+        }
+        (*results)["kind"].add(timer.nsecsElapsed(), nodes.size());
+
+        // Pairs are picked the same way in every run
+        Random random(config.seed + iteration);
+        QVector<QPair<int, int> > pairs(nodes.size());
+        for (int i = 0; i < pairs.size(); ++i) {
+            pairs[i] = qMakePair(random.bounded(nodes.size()), random.bounded(nodes.size()));
+        }
+        timer.start();
+        for (int i = 0; i < pairs.size(); ++i) {
+            count += model.compareOrder(nodes.at(pairs.at(i).first), nodes.at(pairs.at(i).second));
+        }
+        (*results)["compare_order"].add(timer.nsecsElapsed(), pairs.size());
+
+        QVector<QXmlNodeModelIndex> named = elements + attributes;
+        timer.start();
+        for (int i = 0; i < named.size(); ++i) {
+            count += !model.name(named.at(i)).isNull();
+        }
+        (*results)["name"].add(timer.nsecsElapsed(), named.size());
+
+        timer.start();
+        for (int i = 0; i < elements.size(); ++i) {
+            count += model.stringValue(elements.at(i)).size();
+        }
+        (*results)["string_value.element"].add(timer.nsecsElapsed(), elements.size());
+
+        timer.start();
+        for (int i = 0; i < attributes.size(); ++i) {
+            count += model.stringValue(attributes.at(i)).size();
+        }
+        (*results)["string_value.attribute"].add(timer.nsecsElapsed(), attributes.size());
+
+        timer.start();
+        for (int i = 0; i < attributes.size(); ++i) {
+            count += model.typedValue(attributes.at(i)).isValid();
+        }
+        (*results)["typed_value.attribute"].add(timer.nsecsElapsed(), attributes.size());
+
+        for (int i = 0; i < config.queries.size(); ++i) {
+            QString key = QString("query.%1").arg(i);
+
+            timer.start();
+            QXmlQuery query(namePool);
+            query.bindVariable("dom", model.dom());
+            query.setFocus(model.dom());
+            query.setQuery(config.queries.at(i));
+            QXmlResultItems items;
+            query.evaluateTo(&items);
+            for (QXmlItem item = items.next(); !item.isNull(); item = items.next()) {
+                ++count;
+            }
+            (*results)[key].add(timer.nsecsElapsed(), 1);
+
+            key = QString("xpath.%1").arg(i);
+            QStringList strings;
+            timer.start();
+            model.evaluateXPath(config.queries.at(i), &strings);
+            (*results)[key].add(timer.nsecsElapsed(), 1);
+            count += strings.size();
+        }
+
+        sink += count;
+    }
+}
+
+// Returns the latency per operation below which p percent of samples are
+static double percentile(const QVector<double> &sorted, double p)
+{
+    if (sorted.isEmpty()) {
+        return 0;
+    }
+    int rank = qBound(0, int(p / 100.0 * sorted.size() + 0.999999) - 1, sorted.size() - 1);
+    return sorted.at(rank);
+}
+
+static QString jsonString(const QString &str)
+{
+    QString result = "\"";
+    for (int i = 0; i < str.size(); ++i) {
+        QChar c = str.at(i);
+        if (c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if (c.unicode() < 0x20) {
+            result += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+// Returns peak resident set size of the process in kilobytes
+static qint64 peakRss()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MAC
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return -1;
+}
+
+static void writeJson(QTextStream &out, const Config &config, int documents, qint64 bytes, const QMap<QString, Result> &results)
+{
+    out << "{\n";
+    out << "  \"format_version\": " << FormatVersion << ",\n";
+    out << "  \"label\": " << jsonString(config.label) << ",\n";
+    out << "  \"config\": {\n";
+    if (config.corpus.isEmpty()) {
+        out << "    \"depth\": " << config.depth << ",\n";
+        out << "    \"fanout\": " << config.fanout << ",\n";
+        out << "    \"attributes\": " << config.attributes << ",\n";
+        out << "    \"text_size\": " << config.textSize << ",\n";
+        out << "    \"seed\": " << config.seed << ",\n";
+    } else {
+        out << "    \"corpus\": " << jsonString(config.corpus) << ",\n";
+    }
+    out << "    \"iterations\": " << config.iterations << ",\n";
+    out << "    \"frozen\": " << (config.freeze ? "true" : "false") << ",\n";
+    out << "    \"queries\": [";
+    for (int i = 0; i < config.queries.size(); ++i) {
+        out << (i ? ", " : "") << jsonString(config.queries.at(i));
+    }
+    out << "]\n";
+    out << "  },\n";
+    out << "  \"documents\": " << documents << ",\n";
+    out << "  \"bytes\": " << bytes << ",\n";
+    out << "  \"peak_rss_kb\": " << peakRss() << ",\n";
+    out << "  \"benchmarks\": [\n";
+
+    QMap<QString, Result>::const_iterator it;
+    for (it = results.constBegin(); it != results.constEnd(); ++it) {
+        const Result &result = it.value();
+
+        qint64 totalNsecs = 0;
+        qint64 totalOps = 0;
+        QVector<double> latencies;
+        for (int i = 0; i < result.nsecs.size(); ++i) {
+            totalNsecs += result.nsecs.at(i);
+            totalOps += result.ops.at(i);
+            if (result.ops.at(i) > 0) {
+                latencies.append(double(result.nsecs.at(i)) / result.ops.at(i));
+            }
+        }
+        qSort(latencies);
+        double seconds = totalNsecs / 1e9;
+
+        out << "    {\n";
+        out << "      \"name\": " << jsonString(it.key()) << ",\n";
+        out << "      \"samples\": " << result.nsecs.size() << ",\n";
+        out << "      \"ops\": " << totalOps << ",\n";
+        out << "      \"seconds\": " << seconds << ",\n";
+        out << "      \"ops_per_second\": " << (seconds > 0 ? totalOps / seconds : 0) << ",\n";
+        if (result.bytes > 0) {
+            out << "      \"bytes_per_second\": " << (seconds > 0 ? result.bytes / seconds : 0) << ",\n";
+        }
+        out << "      \"latency_ns\": { \"p50\": " << percentile(latencies, 50)
+            << ", \"p90\": " << percentile(latencies, 90)
+            << ", \"p99\": " << percentile(latencies, 99)
+            << ", \"max\": " << (latencies.isEmpty() ? 0 : latencies.last()) << " }\n";
+        out << "    }" << (it + 1 != results.constEnd() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+}
+
+static void usage(const char *program)
+{
+    qFatal("Usage: %s [options]\n"
+           "  --depth N        depth of synthetic documents (6)\n"
+           "  --fanout N       children of each synthetic element (4)\n"
+           "  --attributes N   attributes of each synthetic element (2)\n"
+           "  --text N         bytes of text in each synthetic element (32)\n"
+           "  --documents N    number of synthetic documents (4)\n"
+           "  --seed N         seed of synthetic documents (1)\n"
+           "  --corpus DIR     benchmark *.html files below DIR instead\n"
+           "  --iterations N   passes over each document (10)\n"
+           "  --freeze         benchmark frozen models\n"
+           "  --query EXPR     query to benchmark, could be repeated\n"
+           "  --label TEXT     label stored in the results", program);
+}
+
+// Program entry point
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    Config config;
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        const QString &arg = args.at(i);
+        if (arg == "--freeze") {
+            config.freeze = true;
+            continue;
+        }
+        if (i + 1 >= args.size()) {
+            usage(argv[0]);
+        }
+        QString value = args.at(++i);
+        if (arg == "--depth") {
+            config.depth = value.toInt();
+        } else if (arg == "--fanout") {
+            config.fanout = value.toInt();
+        } else if (arg == "--attributes") {
+            config.attributes = value.toInt();
+        } else if (arg == "--text") {
+            config.textSize = value.toInt();
+        } else if (arg == "--documents") {
+            config.documents = value.toInt();
+        } else if (arg == "--seed") {
+            config.seed = value.toUInt();
+        } else if (arg == "--corpus") {
+            config.corpus = value;
+        } else if (arg == "--iterations") {
+            config.iterations = value.toInt();
+        } else if (arg == "--query") {
+            config.queries.append(value);
+        } else if (arg == "--label") {
+            config.label = value;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.queries.isEmpty()) {
+        config.queries << "count(//*)" << "//a/@href" << "//div[@class='c1 c2']//span" << "string(//title)";
+    }
+
+    QList<QPair<QString, QByteArray> > documents;
+    if (config.corpus.isEmpty()) {
+        for (int i = 0; i < config.documents; ++i) {
+            documents.append(qMakePair(QString("synthetic:%1").arg(i), generateDocument(config, config.seed + i)));
+        }
+    } else {
+        documents = readCorpus(config.corpus);
+    }
+    if (documents.isEmpty()) {
+        qFatal("Err, no documents to benchmark");
+    }
+
+    QXmlNamePool namePool;
+    QMap<QString, Result> results;
+    qint64 bytes = 0;
+    for (int i = 0; i < documents.size(); ++i) {
+        benchDocument(config, namePool, documents.at(i).first, documents.at(i).second, &results);
+        bytes += documents.at(i).second.size();
+    }
+
+    QFile outFile;
+    outFile.open(stdout, QIODevice::WriteOnly);
+    QTextStream out(&outFile);
+    writeJson(out, config, documents.size(), bytes, results);
+    return 0;
+}
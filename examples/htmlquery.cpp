@@ -31,12 +31,30 @@
  */
 
 
+#include <stdio.h>
+#include <stdlib.h>
+
 #include <QCoreApplication>
+#include <QDirIterator>
 #include <QFile>
+#include <QFileInfo>
+#include <QFuture>
+#include <QQueue>
+#include <QScopedPointer>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrentRun>
 #include <QXmlQuery>
 #include <QXmlFormatter>
+#include <QXmlResultItems>
 
+#include "qlibxmlbatchquery.h"
+#include "qlibxmlcollectionmodel.h"
 #include "qlibxmlnodemodel.h"
+#include "qlibxmlqueryrunner.h"
+#include "qlibxmlserializer.h"
+#include "qlibxmlsnapshotcache.h"
+#include "qlibxmlstreamextractor.h"
 
 
 // Opens a file for reading, using stdout if the path is -
@@ -50,51 +68,365 @@ static bool openFile(QFile *f, const QString &path)
     }
 }
 
+// Prints statistics of the model to stderr
+static void printStatistics(const QLibXmlNodeModel::Statistics &stats)
+{
+    fprintf(stderr, "parse time (ms): %.3f\n", stats.parseNsecs / 1e6);
+    fprintf(stderr, "nodes: %lld\n", stats.nodeCount);
+    fprintf(stderr, "parent calls: %lld\n", stats.axisCalls[QAbstractXmlNodeModel::Parent]);
+    fprintf(stderr, "first child calls: %lld\n", stats.axisCalls[QAbstractXmlNodeModel::FirstChild]);
+    fprintf(stderr, "previous sibling calls: %lld\n", stats.axisCalls[QAbstractXmlNodeModel::PreviousSibling]);
+    fprintf(stderr, "next sibling calls: %lld\n", stats.axisCalls[QAbstractXmlNodeModel::NextSibling]);
+    fprintf(stderr, "compareOrder calls: %lld\n", stats.compareOrderCalls);
+    fprintf(stderr, "name calls: %lld\n", stats.nameCalls);
+    fprintf(stderr, "kind calls: %lld\n", stats.kindCalls);
+    fprintf(stderr, "attributes calls: %lld\n", stats.attributesCalls);
+    fprintf(stderr, "stringValue calls: %lld\n", stats.stringValueCalls);
+    fprintf(stderr, "typedValue calls: %lld\n", stats.typedValueCalls);
+    fprintf(stderr, "string characters: %lld\n", stats.stringChars);
+    fprintf(stderr, "value cache hits: %lld\n", stats.valueCacheHits);
+    fprintf(stderr, "value cache misses: %lld\n", stats.valueCacheMisses);
+}
+
+// Returns the files in the directory and its subdirectories, sorted
+static QStringList listFiles(const QString &dir)
+{
+    QStringList files;
+    QDirIterator it(dir, QDir::Files | QDir::Readable, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+    while (it.hasNext()) {
+        files.append(it.next());
+    }
+    files.sort();
+    return files;
+}
+
+// Evaluates the batch query on one file, run on the thread pool
+static QByteArray evaluateFile(const QLibXmlBatchQuery &batch, const QString &path)
+{
+    return batch.evaluate(path);
+}
+
+// Writes the result of the oldest file in flight to stdout
+static bool writeResult(QQueue<QPair<QString, QFuture<QByteArray> > > *pending, QFile *out)
+{
+    QPair<QString, QFuture<QByteArray> > file = pending->dequeue();
+    QByteArray result = file.second.result();
+    if (result.isNull()) {
+        fprintf(stderr, "Err, can't evaluate query on %s\n", qPrintable(file.first));
+        return false;
+    }
+
+    out->write("==> " + file.first.toLocal8Bit() + " <==\n");
+    out->write(result);
+    if (!result.endsWith('\n')) {
+        out->write("\n");
+    }
+    return true;
+}
+
+// Evaluates the query on files given as arguments, files in directories
+// given as arguments, or files listed one per line on stdin. At most
+// twice as many files as there are threads are in flight, results are
+// written in the order of the files.
+static int runBatch(const char *queryPath, char **paths, int count, int threads)
+{
+    QFile queryFile;
+    if (!openFile(&queryFile, queryPath)) {
+        qFatal("Err, can't open XQuery file %s", queryPath);
+    }
+    QLibXmlBatchQuery batch(QString::fromUtf8(queryFile.readAll()), QUrl::fromLocalFile(queryPath));
+
+    if (threads > 0) {
+        QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    }
+    int window = 2 * QThreadPool::globalInstance()->maxThreadCount();
+
+    // Files given as arguments come first, then files read from stdin
+    QStringList files;
+    for (int i = 0; i < count; ++i) {
+        QString path = QString::fromLocal8Bit(paths[i]);
+        if (QFileInfo(path).isDir()) {
+            files += listFiles(path);
+        } else {
+            files.append(path);
+        }
+    }
+    QFile in;
+    QTextStream stream;
+    if (count == 0) {
+        in.open(stdin, QIODevice::ReadOnly);
+        stream.setDevice(&in);
+    }
+
+    QFile out;
+    out.open(stdout, QIODevice::WriteOnly);
+
+    QQueue<QPair<QString, QFuture<QByteArray> > > pending;
+    bool ok = true;
+    int next = 0;
+    for (;;) {
+        QString path;
+        if (next < files.count()) {
+            path = files.at(next++);
+        } else if (stream.device() && !stream.atEnd()) {
+            path = stream.readLine().trimmed();
+            if (path.isEmpty()) {
+                continue;
+            }
+        } else {
+            break;
+        }
+
+        if (pending.count() >= window) {
+            ok &= writeResult(&pending, &out);
+        }
+        pending.enqueue(qMakePair(path, QtConcurrent::run(evaluateFile, batch, path)));
+    }
+    while (!pending.isEmpty()) {
+        ok &= writeResult(&pending, &out);
+    }
+
+    return ok ? 0 : 1;
+}
+
+// Evaluates the query once on a collection of files given as arguments
+// or in directories given as arguments, with $dom bound to the root of
+// the collection. Files are parsed as the query reaches them.
+static int runCollection(const char *queryPath, char **paths, int count, const char *cachePath)
+{
+    QXmlQuery query;
+    QLibXmlCollectionModel collection(query.namePool());
+    for (int i = 0; i < count; ++i) {
+        QString path = QString::fromLocal8Bit(paths[i]);
+        QStringList files = QFileInfo(path).isDir() ? listFiles(path) : QStringList(path);
+        for (int j = 0; j < files.size(); ++j) {
+            collection.addFile(files.at(j));
+        }
+    }
+
+    QScopedPointer<QLibXmlSnapshotCache> cache;
+    if (cachePath) {
+        cache.reset(new QLibXmlSnapshotCache(QString::fromLocal8Bit(cachePath)));
+        collection.setSnapshotCache(cache.data());
+    }
+
+    query.bindVariable("dom", collection.dom());
+    query.setFocus(collection.dom());
+
+    QFile queryFile;
+    if (!openFile(&queryFile, queryPath)) {
+        qFatal("Err, can't open XQuery file %s", queryPath);
+    }
+    query.setQuery(&queryFile, QUrl::fromLocalFile(queryPath));
+
+    QFile out;
+    out.open(stdout, QIODevice::WriteOnly);
+    QXmlFormatter formatter(query, &out);
+    return query.evaluateTo(&formatter) ? 0 : 1;
+}
+
+// Evaluates the query on each fragment of a streamed document
+class FragmentQuery : public QLibXmlStreamHandler
+{
+public:
+    FragmentQuery(const QString &query, const QUrl &queryUri, const QXmlNamePool &namePool, QIODevice *out)
+        : query(query), runner(namePool, queryUri), out(out), ok(true)
+    {
+    }
+
+    virtual bool handleFragment(const QLibXmlNodeModel &model)
+    {
+        ok &= runner.evaluate(query, model, out);
+        out->write("\n");
+        return true;
+    }
+
+    QString query;
+    QLibXmlQueryRunner runner;
+    QIODevice *out;
+    bool ok;
+};
+
+// Evaluates the query on each subtree of the file matching the path,
+// without loading the whole file into memory
+static int runStream(const char *path, const char *htmlPath, const char *queryPath)
+{
+    QXmlNamePool namePool;
+    QLibXmlStreamExtractor extractor(namePool);
+    if (!extractor.setPath(QString::fromUtf8(path))) {
+        qFatal("Err, unsupported stream path %s", path);
+    }
+
+    QFile queryFile;
+    if (!openFile(&queryFile, queryPath)) {
+        qFatal("Err, can't open XQuery file %s", queryPath);
+    }
+
+    QFile out;
+    out.open(stdout, QIODevice::WriteOnly);
+    FragmentQuery handler(QString::fromUtf8(queryFile.readAll()), QUrl::fromLocalFile(queryPath), namePool, &out);
+
+    QFile htmlFile;
+    if (!openFile(&htmlFile, htmlPath)) {
+        qFatal("Err, can't open HTML file %s", htmlPath);
+    }
+    if (!extractor.extract(&htmlFile, QUrl::fromLocalFile(htmlPath), &handler)) {
+        return 1;
+    }
+    return handler.ok ? 0 : 1;
+}
+
 // Program entry point
 int main(int argc, char **argv)
 {
+    // Options come before file names
+    bool stats = false;
+    bool native = false;
+    bool batch = false;
+    bool collection = false;
+    const char *streamPath = NULL;
+    const char *cachePath = NULL;
+    int threads = 0;
+    int first = 1;
+    for (; first < argc; ++first) {
+        if (!strcmp(argv[first], "--stats")) {
+            stats = true;
+        } else if (!strcmp(argv[first], "--native")) {
+            native = true;
+        } else if (!strcmp(argv[first], "--batch")) {
+            batch = true;
+        } else if (!strcmp(argv[first], "--collection")) {
+            collection = true;
+        } else if (!strcmp(argv[first], "--stream") && first + 1 < argc) {
+            streamPath = argv[++first];
+        } else if (!strcmp(argv[first], "--cache") && first + 1 < argc) {
+            cachePath = argv[++first];
+        } else if (!strcmp(argv[first], "-j") && first + 1 < argc) {
+            threads = atoi(argv[++first]);
+        } else {
+            break;
+        }
+    }
+
     // Validate arguments
-    if (argc < 3) {
-        qFatal("Usage: %s <html-file> <xquery-file>\nUse - to read from stdin", argv[0]);
+    if (argc - first < (batch ? 1 : 2)) {
+        qFatal("Usage: %s [--stats] [--native] [--cache <dir>] <html-file> <xquery-file>\n"
+               "       %s --batch [-j <threads>] <xquery-file> [<html-file-or-dir>...]\n"
+               "       %s --collection [--cache <dir>] <xquery-file> <html-file-or-dir>...\n"
+               "       %s --stream <path> <html-file> <xquery-file>\nUse - to read from stdin\n"
+               "--stats prints parse time and node model call counts to stderr\n"
+               "--native writes result nodes with libxml instead of QXmlFormatter\n"
+               "--cache keeps snapshots of parsed files in <dir>, so a file is only\n"
+               "        parsed again when it changes\n"
+               "--batch evaluates the query on many files on <threads> threads, reading\n"
+               "        file names from stdin if none are given\n"
+               "--stream evaluates the query on each subtree matching <path>, such as\n"
+               "         //div[@class='item'], parsing the file in constant memory\n"
+               "With --batch and --stream the query starts at each document, which\n"
+               "is also bound to $dom\n"
+               "--collection evaluates the query once on all files, with $dom bound\n"
+               "             to the root of a collection of them", argv[0], argv[0], argv[0], argv[0]);
+    }
+    if (batch) {
+        if (stats || native || streamPath || cachePath || collection) {
+            qFatal("Err, --stats, --native, --stream, --cache and --collection can't be used with --batch");
+        }
+        if (!strcmp(argv[first], "-") && argc - first == 1) {
+            qFatal("Err, cannot read both file names and XQuery file from stdin");
+        }
+        QCoreApplication app(argc, argv);
+        return runBatch(argv[first], argv + first + 1, argc - first - 1, threads);
+    }
+    if (collection) {
+        if (stats || native || streamPath || threads) {
+            qFatal("Err, --stats, --native, --stream and -j can't be used with --collection");
+        }
+        QCoreApplication app(argc, argv);
+        return runCollection(argv[first], argv + first + 1, argc - first - 1, cachePath);
     }
-    if (!strcmp(argv[1], "-") && !strcmp(argv[2], "-")) {
+
+    const char *htmlPath = argv[first];
+    const char *queryPath = argv[first + 1];
+    if (!strcmp(htmlPath, "-") && !strcmp(queryPath, "-")) {
         qFatal("Err, cannot read both HTML and XQuery file from stdin");
     }
 
     // We'll need a QCoreApplication instance for this
     QCoreApplication app(argc, argv);
 
+    if (streamPath) {
+        if (stats || native || cachePath) {
+            qFatal("Err, --stats, --native and --cache can't be used with --stream");
+        }
+        return runStream(streamPath, htmlPath, queryPath);
+    }
+
     // Setup query first, so we can use its name pool
     QXmlQuery query;
 
-    // Read HTML data
-    QFile htmlFile;
-    if (!openFile(&htmlFile, argv[1])) {
-        qFatal("Err, can't open HTML file %s", argv[1]);
+    // Read HTML data, files are mapped into memory, stdin is streamed
+    QLibXmlNodeModel::ParseOptions options;
+    if (stats) {
+        options.flags |= QLibXmlNodeModel::CollectStatistics;
+    }
+    QScopedPointer<QLibXmlNodeModel> model;
+    if (cachePath) {
+        // Files are looked up by their size and modification time, only
+        // stdin has to be read to find its snapshot
+        QLibXmlSnapshotCache cache(QString::fromLocal8Bit(cachePath));
+        if (!strcmp(htmlPath, "-")) {
+            QFile htmlFile;
+            if (!openFile(&htmlFile, htmlPath)) {
+                qFatal("Err, can't open HTML file %s", htmlPath);
+            }
+            model.reset(cache.model(query.namePool(), htmlFile.readAll(), QUrl::fromLocalFile(htmlPath), options));
+        } else {
+            if (!QFileInfo(htmlPath).isReadable()) {
+                qFatal("Err, can't open HTML file %s", htmlPath);
+            }
+            model.reset(cache.model(query.namePool(), QString::fromLocal8Bit(htmlPath), options));
+        }
+    } else if (!strcmp(htmlPath, "-")) {
+        QFile htmlFile;
+        if (!openFile(&htmlFile, htmlPath)) {
+            qFatal("Err, can't open HTML file %s", htmlPath);
+        }
+        model.reset(new QLibXmlNodeModel(query.namePool(), &htmlFile, QUrl::fromLocalFile(htmlPath), options));
+    } else {
+        if (!QFileInfo(htmlPath).isReadable()) {
+            qFatal("Err, can't open HTML file %s", htmlPath);
+        }
+        model.reset(new QLibXmlNodeModel(query.namePool(), QString::fromLocal8Bit(htmlPath), options));
     }
-    QByteArray source = htmlFile.readAll();
-    QLibXmlNodeModel model(query.namePool(), source, QUrl::fromLocalFile(argv[1]));
 
     // Bind the "dom" variable to the root element of the document
-    query.bindVariable("dom", model.dom());
+    query.bindVariable("dom", model->dom());
 
-    query.setFocus(model.dom());
+    query.setFocus(model->dom());
 
     // Setup the query
     QFile queryFile;
-    if (!openFile(&queryFile, argv[2])) {
-        qFatal("Err, can't open XQuery file %s", argv[2]);
+    if (!openFile(&queryFile, queryPath)) {
+        qFatal("Err, can't open XQuery file %s", queryPath);
     }
-    query.setQuery(&queryFile, QUrl::fromLocalFile(argv[2]));
+    query.setQuery(&queryFile, QUrl::fromLocalFile(queryPath));
 
-    // Setup a formatter printing to stdout
     QFile out;
     out.open(stdout, QIODevice::WriteOnly);
-    QXmlFormatter formatter(query, &out);
 
-    // Evaluate and exit
-    if (!query.evaluateTo(&formatter)) {
-        return 1;
+    // Evaluate, printing to stdout
+    bool ok;
+    if (native) {
+        QXmlResultItems items;
+        query.evaluateTo(&items);
+        QLibXmlSerializer serializer(query.namePool(), &out);
+        ok = serializer.write(&items);
+    } else {
+        QXmlFormatter formatter(query, &out);
+        ok = query.evaluateTo(&formatter);
+    }
+    if (stats) {
+        printStatistics(model->statistics());
     }
-    return 0;
+    return ok ? 0 : 1;
 }
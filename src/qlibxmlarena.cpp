@@ -0,0 +1,536 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <QVector>
+#include <QtGlobal>
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include <libxml/xmlmemory.h>
+
+#include "qlibxmlarena_p.h"
+
+#if defined(_MSC_VER)
+#define QLIBXML_THREAD_LOCAL __declspec(thread)
+#else
+#define QLIBXML_THREAD_LOCAL __thread
+#endif
+
+// Chunks are made of slots of the reserved range. The first chunk of an
+// arena is one slot, following ones are twice as large up to the maximum.
+static const size_t SlotSize = 65536;
+static const size_t MaxChunkSize = 1048576;
+
+// Address range reserved for chunks of all arenas. Only pages of chunks
+// in use take memory.
+#if QT_POINTER_SIZE == 8
+static const size_t RegionSize = (size_t)4 << 30;
+#else
+static const size_t RegionSize = (size_t)256 << 20;
+#endif
+static const size_t SlotCount = RegionSize / SlotSize;
+
+// Chunks are a power of two slots large, freed runs of slots are kept
+// in a list for each size
+#if QT_POINTER_SIZE == 8
+static const int SizeClassCount = 17;
+#else
+static const int SizeClassCount = 13;
+#endif
+
+// Blocks are aligned like malloc() ones and start with their size
+static const size_t Alignment = 16;
+
+static inline size_t aligned(size_t size)
+{
+    return (size + Alignment - 1) & ~(Alignment - 1);
+}
+
+// Arena of the thread, NULL outside of scopes
+static QLIBXML_THREAD_LOCAL QLibXmlArena *currentArena = NULL;
+
+// The reserved range, and for each slot one more than the first slot of
+// the chunk it belongs to, 0 for free slots. Set up by install() before
+// the allocation functions are replaced.
+static char *regionStart = NULL;
+static char *regionEnd = NULL;
+static quint32 *slotChunks = NULL;
+
+// Functions libxml used before the arena ones were installed
+static xmlFreeFunc heapFree = NULL;
+static xmlMallocFunc heapMalloc = NULL;
+static xmlMallocFunc heapMallocAtomic = NULL;
+static xmlReallocFunc heapRealloc = NULL;
+static xmlStrdupFunc heapStrdup = NULL;
+
+// Slots which are not used by chunks. Runs of freed chunks are reused
+// by chunks of the same size, slots never used are taken from the end.
+// Finding a run is constant, so parses on many threads only contend for
+// the mutex briefly.
+struct SlotTable
+{
+    SlotTable() : nextUnused(0), installAttempted(false) {}
+
+    QMutex mutex;
+    size_t nextUnused;
+    QVector<quint32> freeRuns[SizeClassCount];
+    bool installAttempted;
+};
+Q_GLOBAL_STATIC(SlotTable, slotTable)
+
+// Returns the size class of a run, which is a power of two slots
+static int sizeClass(size_t count)
+{
+    int result = 0;
+    while (((size_t)1 << result) < count) {
+        ++result;
+    }
+    return result;
+}
+
+static void arenaFree(void *ptr)
+{
+    if (!QLibXmlArena::owns(ptr)) {
+        heapFree(ptr);
+    }
+}
+
+static void *arenaMalloc(size_t size)
+{
+    QLibXmlArena *arena = currentArena;
+    return arena != NULL ? arena->allocate(size) : heapMalloc(size);
+}
+
+static void *arenaMallocAtomic(size_t size)
+{
+    QLibXmlArena *arena = currentArena;
+    return arena != NULL ? arena->allocate(size, true) : heapMallocAtomic(size);
+}
+
+// Arena blocks are resized within their arena. New blocks come from the
+// heap, as that is how the parser grows its own tables, which outlive
+// the arena.
+static void *arenaRealloc(void *ptr, size_t size)
+{
+    if (QLibXmlArena::owns(ptr)) {
+        return QLibXmlArena::arenaOf(ptr)->reallocate(ptr, size);
+    }
+    return heapRealloc(ptr, size);
+}
+
+static char *arenaStrdup(const char *str)
+{
+    QLibXmlArena *arena = currentArena;
+    if (arena == NULL) {
+        return heapStrdup(str);
+    }
+    size_t size = strlen(str) + 1;
+    char *copy = (char *)arena->allocate(size, true);
+    if (copy != NULL) {
+        memcpy(copy, str, size);
+    }
+    return copy;
+}
+
+// Header at the start of a chunk, the data follows
+struct QLibXmlArena::Chunk
+{
+    QLibXmlArena *arena;
+    Chunk *next;
+    char *pos;
+    char *end;
+    char *last;
+    size_t slots;
+
+    char *data()
+    {
+        return (char *)this + aligned(sizeof(Chunk));
+    }
+};
+
+QLibXmlArena::QLibXmlArena()
+    : chunks(NULL), nextChunkSize(SlotSize), heapBlocks(false)
+{
+}
+
+QLibXmlArena::~QLibXmlArena()
+{
+    while (chunks != NULL) {
+        Chunk *next = chunks->next;
+        freeChunk(chunks);
+        chunks = next;
+    }
+}
+
+// Reserves the address range of chunks and replaces libxml allocation
+// functions with the arena ones. Only the first call does it, when the
+// first model asks for an arena, so processes which never use arenas
+// keep the allocation functions and the address space untouched.
+//
+// Other threads could be allocating with the previous functions
+// meanwhile. That is safe, as the range is set up before the swap and
+// the arena functions pass every block they do not own, and every
+// allocation outside of a Scope, to the previous functions. Returns
+// false if the range could not be reserved or the functions were
+// replaced by someone else, arenas are not used then.
+bool QLibXmlArena::install()
+{
+    SlotTable *table = slotTable();
+    if (table == NULL) {
+        return false;
+    }
+    QMutexLocker locker(&table->mutex);
+
+    if (!table->installAttempted) {
+        table->installAttempted = true;
+
+        // The previous functions are kept, blocks allocated by them
+        // before are freed by them too
+        xmlFreeFunc freeFunc;
+        if (xmlGcMemGet(&freeFunc, &heapMalloc, &heapMallocAtomic, &heapRealloc, &heapStrdup) != 0) {
+            return false;
+        }
+
+#if defined(Q_OS_WIN)
+        char *region = (char *)VirtualAlloc(NULL, RegionSize, MEM_RESERVE, PAGE_NOACCESS);
+#else
+        char *region = (char *)mmap(NULL, RegionSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == (char *)MAP_FAILED) {
+            region = NULL;
+        }
+#endif
+        if (region == NULL) {
+            return false;
+        }
+        quint32 *slots = (quint32 *)calloc(SlotCount, sizeof(quint32));
+        if (slots == NULL) {
+#if defined(Q_OS_WIN)
+            VirtualFree(region, 0, MEM_RELEASE);
+#else
+            munmap(region, RegionSize);
+#endif
+            return false;
+        }
+
+        heapFree = freeFunc;
+        regionStart = region;
+        regionEnd = region + RegionSize;
+        slotChunks = slots;
+        xmlGcMemSetup(arenaFree, arenaMalloc, arenaMallocAtomic, arenaRealloc, arenaStrdup);
+    }
+
+    return isInstalled();
+}
+
+// Returns true if the arena allocation functions are the ones libxml
+// uses. Another library could have replaced them since they were
+// installed, arenas must not be used then.
+bool QLibXmlArena::isInstalled()
+{
+    if (heapFree == NULL) {
+        return false;
+    }
+
+    xmlFreeFunc freeFunc;
+    xmlMallocFunc mallocFunc;
+    xmlMallocFunc mallocAtomicFunc;
+    xmlReallocFunc reallocFunc;
+    xmlStrdupFunc strdupFunc;
+    xmlGcMemGet(&freeFunc, &mallocFunc, &mallocAtomicFunc, &reallocFunc, &strdupFunc);
+    return freeFunc == arenaFree && mallocFunc == arenaMalloc && reallocFunc == arenaRealloc;
+}
+
+// Returns the arena current for the calling thread
+QLibXmlArena *QLibXmlArena::current()
+{
+    return currentArena;
+}
+
+// Returns true if the block is allocated from any arena
+bool QLibXmlArena::owns(const void *ptr)
+{
+    return ptr >= (const void *)regionStart && ptr < (const void *)regionEnd;
+}
+
+// Returns the chunk of a block owned by an arena
+QLibXmlArena::Chunk *QLibXmlArena::chunkOf(const void *ptr)
+{
+    size_t slot = ((const char *)ptr - regionStart) / SlotSize;
+    return (Chunk *)(regionStart + (slotChunks[slot] - 1) * SlotSize);
+}
+
+// Returns the arena a block owned by an arena belongs to
+QLibXmlArena *QLibXmlArena::arenaOf(const void *ptr)
+{
+    return chunkOf(ptr)->arena;
+}
+
+// Errors raised while an arena is current are copied into it, they are
+// moved to the heap, as libxml keeps the last error after the arena is
+// dropped
+void QLibXmlArena::detachError(xmlErrorPtr error)
+{
+    if (error == NULL) {
+        return;
+    }
+
+    char **strings[] = { &error->message, &error->file, &error->str1, &error->str2, &error->str3 };
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i) {
+        if (*strings[i] != NULL && owns(*strings[i])) {
+            // xmlStrdup() would allocate from the arena again
+            size_t size = strlen(*strings[i]) + 1;
+            char *copy = (char *)heapMallocAtomic(size);
+            if (copy != NULL) {
+                memcpy(copy, *strings[i], size);
+            }
+            *strings[i] = copy;
+        }
+    }
+}
+
+// Returns a run of count free slots to the table
+static void releaseRun(size_t first, size_t count)
+{
+    SlotTable *table = slotTable();
+    if (table == NULL) {
+        return;
+    }
+    QMutexLocker locker(&table->mutex);
+    table->freeRuns[sizeClass(count)].append(first);
+}
+
+// Adds a chunk with room for at least size bytes. Returns NULL if there
+// is no run of free slots that large left, or its pages could not be
+// committed.
+QLibXmlArena::Chunk *QLibXmlArena::addChunk(size_t size)
+{
+    size_t capacity = nextChunkSize;
+    while (capacity < aligned(sizeof(Chunk)) + size && capacity < RegionSize) {
+        capacity *= 2;
+    }
+    if (capacity < aligned(sizeof(Chunk)) + size) {
+        return NULL;
+    }
+    if (nextChunkSize < MaxChunkSize) {
+        nextChunkSize *= 2;
+    }
+    size_t count = capacity / SlotSize;
+
+    // Slots taken off the table belong to this chunk, pages are
+    // committed without holding the mutex
+    SlotTable *table = slotTable();
+    if (table == NULL) {
+        return NULL;
+    }
+    QMutexLocker locker(&table->mutex);
+    int wanted = sizeClass(count);
+    size_t first;
+    if (!table->freeRuns[wanted].isEmpty()) {
+        first = table->freeRuns[wanted].last();
+        table->freeRuns[wanted].removeLast();
+    } else if (SlotCount - table->nextUnused >= count) {
+        first = table->nextUnused;
+        table->nextUnused += count;
+    } else {
+        // Splits a larger freed run, the halves not needed are kept
+        // for chunks of their size. Freed runs are not merged, blocks
+        // which fit in no run left are allocated from the heap.
+        int from = wanted;
+        while (from < SizeClassCount && table->freeRuns[from].isEmpty()) {
+            ++from;
+        }
+        if (from == SizeClassCount) {
+            return NULL;
+        }
+        first = table->freeRuns[from].last();
+        table->freeRuns[from].removeLast();
+        for (int size = from - 1; size >= wanted; --size) {
+            table->freeRuns[size].append(first + ((size_t)1 << size));
+        }
+    }
+    locker.unlock();
+
+    char *start = regionStart + first * SlotSize;
+#if defined(Q_OS_WIN)
+    bool committed = VirtualAlloc(start, capacity, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+    bool committed = mprotect(start, capacity, PROT_READ | PROT_WRITE) == 0;
+#endif
+    if (!committed) {
+        releaseRun(first, count);
+        return NULL;
+    }
+    for (size_t slot = first; slot < first + count; ++slot) {
+        slotChunks[slot] = first + 1;
+    }
+
+    Chunk *chunk = (Chunk *)start;
+    chunk->arena = this;
+    chunk->next = chunks;
+    chunk->pos = chunk->data();
+    chunk->end = start + capacity;
+    chunk->last = NULL;
+    chunk->slots = count;
+    chunks = chunk;
+    return chunk;
+}
+
+// Returns the pages of a chunk to the system and its slots to the range
+void QLibXmlArena::freeChunk(Chunk *chunk)
+{
+    char *start = (char *)chunk;
+    size_t count = chunk->slots;
+    size_t first = (start - regionStart) / SlotSize;
+
+#if defined(Q_OS_WIN)
+    VirtualFree(start, count * SlotSize, MEM_DECOMMIT);
+#else
+    mmap(start, count * SlotSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+#endif
+    for (size_t slot = first; slot < first + count; ++slot) {
+        slotChunks[slot] = 0;
+    }
+    releaseRun(first, count);
+}
+
+// Returns a block of size bytes. When no chunk could be added, because
+// the reserved range is used up by other arenas or memory could not be
+// committed, the block is allocated from the heap instead, as an atomic
+// one if atomic is true. Freeing and resizing tell such blocks apart by
+// their address.
+void *QLibXmlArena::allocate(size_t size, bool atomic)
+{
+    size_t total = Alignment + aligned(size);
+    Chunk *chunk = chunks;
+    if (chunk == NULL || (size_t)(chunk->end - chunk->pos) < total) {
+        chunk = addChunk(total);
+        if (chunk == NULL) {
+            heapBlocks = true;
+            return atomic ? heapMallocAtomic(size) : heapMalloc(size);
+        }
+    }
+
+    char *block = chunk->pos + Alignment;
+    *(size_t *)chunk->pos = aligned(size);
+    chunk->pos += total;
+    chunk->last = block;
+    return block;
+}
+
+// Resizes a block. The last block of the current chunk grows in place,
+// which is how text is appended to while parsing.
+void *QLibXmlArena::reallocate(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return allocate(size);
+    }
+
+    size_t &capacity = *(size_t *)((char *)ptr - Alignment);
+    if (size <= capacity) {
+        return ptr;
+    }
+
+    Chunk *chunk = chunks;
+    if (chunk->last == ptr && (size_t)(chunk->end - (char *)ptr) >= aligned(size)) {
+        capacity = aligned(size);
+        chunk->pos = (char *)ptr + capacity;
+        return ptr;
+    }
+
+    void *block = allocate(size);
+    if (block != NULL) {
+        memcpy(block, ptr, capacity);
+    }
+    return block;
+}
+
+// Returns true if blocks were allocated from the heap since the arena
+// was reset, see allocate(). Those have to be freed one by one.
+bool QLibXmlArena::hasHeapBlocks() const
+{
+    return heapBlocks;
+}
+
+// Drops all blocks. The latest chunk, which is the largest one, is kept
+// for the next document.
+void QLibXmlArena::reset()
+{
+    heapBlocks = false;
+    if (chunks == NULL) {
+        return;
+    }
+
+    Chunk *next = chunks->next;
+    while (next != NULL) {
+        Chunk *following = next->next;
+        freeChunk(next);
+        next = following;
+    }
+    chunks->next = NULL;
+    chunks->pos = chunks->data();
+    chunks->last = NULL;
+}
+
+QLibXmlArena::Scope::Scope(QLibXmlArena *arena)
+    : previous(currentArena), active(arena != NULL)
+{
+    if (active) {
+        currentArena = arena;
+    }
+}
+
+QLibXmlArena::Scope::~Scope()
+{
+    if (active) {
+        currentArena = previous;
+    }
+}
+
+QLibXmlArena::TreeScope::TreeScope(QLibXmlArena *arena, xmlErrorPtr parserError)
+    : Scope(arena), parserError(parserError)
+{
+}
+
+QLibXmlArena::TreeScope::~TreeScope()
+{
+    detachError(parserError);
+    detachError((xmlErrorPtr)xmlGetLastError());
+}
@@ -0,0 +1,114 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QLIBXMLARENA_P_H
+#define QLIBXMLARENA_P_H
+
+#include <stddef.h>
+
+#include <libxml/xmlerror.h>
+
+// Bump allocator libxml allocates tree nodes from. Blocks are never
+// freed one by one, all of them are dropped by reset().
+//
+// libxml only has process-wide allocation functions, so install() replaces
+// them, the first time an arena is asked for, by ones allocating from the
+// arena made current for the calling thread by a Scope, and from the heap
+// otherwise. Chunks of all arenas are carved from one reserved address
+// range, so a block is known to belong to an arena from its address alone,
+// whichever thread frees or resizes it. Freeing an arena block does
+// nothing, resizing it allocates from its arena. When the range is used
+// up, blocks come from the heap and have to be freed as usual, see
+// hasHeapBlocks(). Nothing which outlives the arena must be allocated
+// while it is current.
+class QLibXmlArena
+{
+public:
+    // Makes the arena current for the calling thread while it exists,
+    // a null arena leaves the current one
+    class Scope
+    {
+    public:
+        explicit Scope(QLibXmlArena *arena);
+        ~Scope();
+
+    private:
+        QLibXmlArena *previous;
+        bool active;
+    };
+
+    // Scope of a parser handler building the tree. Errors raised
+    // meanwhile are copied into the arena, not all of them reach the
+    // error handler, and libxml keeps the last ones after the arena is
+    // dropped, so they are moved out of it.
+    class TreeScope : public Scope
+    {
+    public:
+        TreeScope(QLibXmlArena *arena, xmlErrorPtr parserError);
+        ~TreeScope();
+
+    private:
+        xmlErrorPtr parserError;
+    };
+
+    QLibXmlArena();
+    ~QLibXmlArena();
+
+    static bool install();
+    static bool isInstalled();
+    static QLibXmlArena *current();
+    static bool owns(const void *ptr);
+    static QLibXmlArena *arenaOf(const void *ptr);
+    static void detachError(xmlErrorPtr error);
+
+    void *allocate(size_t size, bool atomic = false);
+    void *reallocate(void *ptr, size_t size);
+    bool hasHeapBlocks() const;
+    void reset();
+
+private:
+    struct Chunk;
+
+    QLibXmlArena(const QLibXmlArena&);
+    QLibXmlArena &operator=(const QLibXmlArena&);
+
+    static Chunk *chunkOf(const void *ptr);
+
+    Chunk *addChunk(size_t size);
+    static void freeChunk(Chunk *chunk);
+
+    Chunk *chunks;
+    size_t nextChunkSize;
+    bool heapBlocks;
+};
+
+#endif // QLIBXMLARENA_P_H
@@ -0,0 +1,251 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QFutureInterface>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSharedData>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QXmlNamePool>
+
+#include "qlibxmlbatchquery.h"
+#include "qlibxmlqueryrunner.h"
+
+// Internal shared data of QLibXmlBatchQuery
+class QLibXmlBatchQueryPrivate : public QSharedData
+{
+public:
+    QString query;
+    QUrl queryUri;
+
+    // Name pool and dictionary are shared by all documents of the batch,
+    // both could be used from many threads. Names cached in a dictionary
+    // given by the caller belong to its name pool, so the batch uses it.
+    QXmlNamePool namePool;
+    QLibXmlDictionary dictionary;
+
+    QLibXmlNodeModel::ParseOptions options;
+
+    // Runners not used by any thread right now. Each thread takes its
+    // own, so the query is compiled once per runner.
+    QList<QLibXmlQueryRunner *> runners;
+    QMutex mutex;
+
+    QLibXmlBatchQueryPrivate(const QString &query, const QUrl &queryUri, const QLibXmlNodeModel::ParseOptions &options)
+        : query(query), queryUri(queryUri),
+          namePool(options.dictionary ? options.dictionary->namePool() : QXmlNamePool()),
+          dictionary(options.dictionary ? *options.dictionary : QLibXmlDictionary(namePool)),
+          options(options)
+    {
+        // The dictionary of the caller is held by this copy, so it lives
+        // as long as the batch
+        this->options.dictionary = &dictionary;
+    }
+
+    ~QLibXmlBatchQueryPrivate()
+    {
+        qDeleteAll(runners);
+    }
+
+    QLibXmlQueryRunner *takeRunner()
+    {
+        QMutexLocker locker(&mutex);
+        if (runners.isEmpty()) {
+            return new QLibXmlQueryRunner(namePool, queryUri);
+        }
+        return runners.takeLast();
+    }
+
+    void returnRunner(QLibXmlQueryRunner *runner)
+    {
+        QMutexLocker locker(&mutex);
+        runners.append(runner);
+    }
+
+    // Evaluates the query against a document, with the document used
+    // as focus and bound to $dom. Returns a null array if the query
+    // failed.
+    QByteArray evaluate(const QLibXmlNodeModel &model)
+    {
+        QByteArray result;
+        QBuffer buffer(&result);
+        buffer.open(QIODevice::WriteOnly);
+
+        QLibXmlQueryRunner *runner = takeRunner();
+        bool ok = runner->evaluate(query, model, &buffer);
+        returnRunner(runner);
+        if (!ok) {
+            return QByteArray();
+        }
+
+        // Tell empty results from failed ones
+        if (result.isNull()) {
+            result = QByteArray("");
+        }
+        return result;
+    }
+};
+
+// Files of a batch evaluated on a thread pool, shared by the runnables
+// working on them
+struct BatchRun
+{
+    BatchRun(const QLibXmlBatchQuery &batch, const QStringList &fileNames, int workers)
+        : batch(batch), fileNames(fileNames), next(0), running(workers)
+    {
+    }
+
+    QLibXmlBatchQuery batch;
+    QStringList fileNames;
+    QFutureInterface<QByteArray> future;
+    QAtomicInt next;
+    QAtomicInt running;
+};
+
+// Evaluates the query for files of a run, taking the next file until
+// none is left. The last runnable to finish finishes the future.
+class BatchWorker : public QRunnable
+{
+public:
+    BatchWorker(const QSharedPointer<BatchRun> &batchRun)
+        : batchRun(batchRun)
+    {
+    }
+
+    virtual void run()
+    {
+        while (!batchRun->future.isCanceled()) {
+            int i = batchRun->next.fetchAndAddOrdered(1);
+            if (i >= batchRun->fileNames.size()) {
+                break;
+            }
+            batchRun->future.reportResult(batchRun->batch.evaluate(batchRun->fileNames.at(i)), i);
+        }
+        if (!batchRun->running.deref()) {
+            batchRun->future.reportFinished();
+        }
+    }
+
+private:
+    QSharedPointer<BatchRun> batchRun;
+};
+
+/*!
+ * Constructs a batch query evaluating \a query, located at \a queryUri,
+ * against many documents parsed as described by \a options. Documents
+ * are used as the focus of the query and bound to \c{$dom}, see
+ * QLibXmlQueryRunner.
+ *
+ * Documents share one name pool and one dictionary. If \a options give
+ * a dictionary, the batch keeps a copy of it and uses its name pool,
+ * otherwise it creates both. All functions could be called from many
+ * threads at once.
+ */
+QLibXmlBatchQuery::QLibXmlBatchQuery(const QString &query, const QUrl &queryUri, const QLibXmlNodeModel::ParseOptions &options)
+    : d(new QLibXmlBatchQueryPrivate(query, queryUri, options))
+{
+}
+
+/*!
+ * Constructs a copy of \a other. Copies share the same data.
+ */
+QLibXmlBatchQuery::QLibXmlBatchQuery(const QLibXmlBatchQuery &other)
+    : d(other.d)
+{
+}
+
+/*!
+ * Destructor
+ */
+QLibXmlBatchQuery::~QLibXmlBatchQuery()
+{
+}
+
+/*!
+ * Makes this object share the data of \a other.
+ */
+QLibXmlBatchQuery &QLibXmlBatchQuery::operator=(const QLibXmlBatchQuery &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/*!
+ * Parses \a source located at \a uri and evaluates the query against it
+ * on the calling thread. Returns the result formatted as XML, or a null
+ * byte array if the query failed.
+ */
+QByteArray QLibXmlBatchQuery::evaluate(const QByteArray &source, const QUrl &uri) const
+{
+    QLibXmlNodeModel model(d->namePool, source, uri, d->options);
+    return d->evaluate(model);
+}
+
+/*!
+ * \overload
+ *
+ * Parses the local file \a fileName.
+ */
+QByteArray QLibXmlBatchQuery::evaluate(const QString &fileName) const
+{
+    QLibXmlNodeModel model(d->namePool, fileName, d->options);
+    return d->evaluate(model);
+}
+
+/*!
+ * \overload
+ *
+ * Evaluates the query against each of \a fileNames on \a pool, or on
+ * the global QThreadPool if it is NULL. The maximum thread count of the
+ * pool limits how many documents are processed at once. Returns
+ * immediately, result \e i of the future belongs to file \e i. Files
+ * not started yet are skipped if the future is canceled.
+ */
+QFuture<QByteArray> QLibXmlBatchQuery::evaluate(const QStringList &fileNames, QThreadPool *pool) const
+{
+    if (pool == NULL) {
+        pool = QThreadPool::globalInstance();
+    }
+
+    int workers = qMax(1, qMin(pool->maxThreadCount(), fileNames.size()));
+    QSharedPointer<BatchRun> batchRun(new BatchRun(*this, fileNames, workers));
+    batchRun->future.reportStarted();
+    QFuture<QByteArray> future = batchRun->future.future();
+    for (int i = 0; i < workers; ++i) {
+        pool->start(new BatchWorker(batchRun));
+    }
+    return future;
+}
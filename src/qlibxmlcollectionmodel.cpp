@@ -0,0 +1,570 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSharedPointer>
+#include <QThreadStorage>
+#include <QWaitCondition>
+#include <QWeakPointer>
+
+#include "qlibxmlcollectionmodel.h"
+#include "qlibxmlsnapshotcache.h"
+
+// Number of members kept loaded by default
+static const int DefaultMaximumLoaded = 32;
+
+// Member a thread visited last, found again without taking the mutex of
+// the collection. Collections are told apart by a serial number, as a
+// new one could take the address of a deleted one. The member is not
+// kept alive by the thread.
+struct QLibXmlLastVisited
+{
+    int collection;
+    int id;
+    QWeakPointer<QLibXmlNodeModel> member;
+};
+
+Q_GLOBAL_STATIC(QThreadStorage<QLibXmlLastVisited *>, lastVisited)
+
+static QAtomicInt nextCollectionSerial;
+
+// Reads a use stamp, QAtomicInt has load() since Qt 5
+static int stampOf(const QAtomicInt &stamp)
+{
+#if QT_VERSION >= 0x050000
+    return stamp.load();
+#else
+    return stamp;
+#endif
+}
+
+// Compares use stamps, which wrap around
+static bool usedBefore(int stamp1, int stamp2)
+{
+    return (int)((uint)stamp1 - (uint)stamp2) < 0;
+}
+
+// Internal private data
+class QLibXmlCollectionModelPrivate
+{
+public:
+    typedef QSharedPointer<QLibXmlNodeModel> Member;
+
+    // State of a member. A member is held by a shared pointer while it
+    // is accessed, so evicting it on another thread does not free it
+    // under the accessor. Members are parsed without holding the mutex,
+    // other threads visiting a member being loaded wait for it.
+    struct Entry
+    {
+        Entry() : lastUsed(0), loading(false) {}
+
+        QString fileName;
+        Member member;
+
+        // Value of the use counter when the member was last visited,
+        // stamped without the mutex when a thread visits it again
+        mutable QAtomicInt lastUsed;
+        bool loading;
+    };
+
+    QLibXmlCollectionModel *model;
+    QUrl uri;
+    QLibXmlNodeModel::ParseOptions options;
+    const QLibXmlSnapshotCache *cache;
+
+    QVector<Entry> entries;
+    int serial;
+    QAtomicInt useCounter;
+    int loadedCount;
+    int maximumLoaded;
+    QMutex mutex;
+    QWaitCondition loaded;
+
+    QLibXmlCollectionModelPrivate(QLibXmlCollectionModel *model, const QUrl &uri, const QLibXmlNodeModel::ParseOptions &parseOptions)
+        : model(model), uri(uri), options(parseOptions), cache(NULL),
+          serial(nextCollectionSerial.fetchAndAddRelaxed(1)), useCounter(0),
+          loadedCount(0), maximumLoaded(DefaultMaximumLoaded)
+    {
+        // Positions in frozen trees do not depend on the memory the
+        // tree is in, so indexes stay valid when a member is loaded again
+        options.flags |= QLibXmlNodeModel::Freeze;
+    }
+
+    // Parses a member, or opens it from the snapshot cache
+    Member open(const QString &fileName) const
+    {
+        if (cache) {
+            return Member(cache->model(model->namePool(), fileName, options));
+        }
+        return Member(new QLibXmlNodeModel(model->namePool(), fileName, options));
+    }
+
+    // Marks the member as the most recently used one
+    void touch(int id)
+    {
+        entries.at(id).lastUsed.fetchAndStoreRelaxed(useCounter.fetchAndAddRelaxed(1) + 1);
+    }
+
+    // Returns the member, loading it if it is not loaded. Accessors are
+    // mostly called for nodes of the member visited last, the mutex is
+    // only taken when the thread visits another one.
+    Member load(int id)
+    {
+        QLibXmlLastVisited *last = lastVisited()->localData();
+        if (last != NULL && last->collection == serial && last->id == id) {
+            Member member = last->member.toStrongRef();
+            if (member) {
+                touch(id);
+                return member;
+            }
+        }
+
+        Member member = loadLocked(id);
+        if (last == NULL) {
+            last = new QLibXmlLastVisited;
+            lastVisited()->setLocalData(last);
+        }
+        last->collection = serial;
+        last->id = id;
+        last->member = member;
+        return member;
+    }
+
+    Member loadLocked(int id)
+    {
+        QMutexLocker locker(&mutex);
+
+        Entry *entry = &entries[id];
+        while (entry->loading) {
+            loaded.wait(&mutex);
+            entry = &entries[id];
+        }
+        if (entry->member) {
+            touch(id);
+            return entry->member;
+        }
+
+        entry->loading = true;
+        QString fileName = entry->fileName;
+        locker.unlock();
+
+        Member member = open(fileName);
+
+        locker.relock();
+        entry = &entries[id];
+        entry->member = member;
+        entry->loading = false;
+        touch(id);
+        ++loadedCount;
+        evict();
+        loaded.wakeAll();
+        return member;
+    }
+
+    // Returns the member if it is loaded, otherwise parses it without
+    // keeping it, so visiting every member once does not evict the
+    // members in use
+    Member visit(int id)
+    {
+        QMutexLocker locker(&mutex);
+        const Entry &entry = entries.at(id);
+        if (entry.member) {
+            return entry.member;
+        }
+        QString fileName = entry.fileName;
+        locker.unlock();
+        return open(fileName);
+    }
+
+    // Drops the least recently used members over the limit. Members are
+    // only scanned when one is loaded, visiting a loaded one is constant.
+    void evict()
+    {
+        while (loadedCount > maximumLoaded && loadedCount > 1) {
+            int oldest = -1;
+            for (int i = 0; i < entries.size(); ++i) {
+                if (entries.at(i).member && (oldest < 0 || usedBefore(stampOf(entries.at(i).lastUsed), stampOf(entries.at(oldest).lastUsed)))) {
+                    oldest = i;
+                }
+            }
+            entries[oldest].member.clear();
+            --loadedCount;
+        }
+    }
+
+    // The collection root, which is the parent of the top level nodes
+    // of all members. Indexes of member nodes keep the member index
+    // data, the member is stored in the additional data, shifted by one
+    // so the root sorts before all members.
+    QXmlNodeModelIndex rootIndex() const
+    {
+        return model->createIndex((qint64)0, (qint64)0);
+    }
+
+    static int memberOf(const QXmlNodeModelIndex &index)
+    {
+        return (int)index.additionalData() - 1;
+    }
+
+    QXmlNodeModelIndex fromMember(int id, const QXmlNodeModelIndex &index) const
+    {
+        if (index.isNull()) {
+            return QXmlNodeModelIndex();
+        }
+        return model->createIndex(index.data(), (qint64)id + 1);
+    }
+
+    static QXmlNodeModelIndex toMember(const Member &member, const QXmlNodeModelIndex &index)
+    {
+        return member->createIndex(index.data());
+    }
+
+    // Accessors of the member models, which are protected
+    static QXmlNodeModelIndex memberAxis(const Member &member, QAbstractXmlNodeModel::SimpleAxis axis, const QXmlNodeModelIndex &index)
+    {
+        return member->nextFromSimpleAxis(axis, index);
+    }
+
+    static QVector<QXmlNodeModelIndex> memberAttributes(const Member &member, const QXmlNodeModelIndex &index)
+    {
+        return member->attributes(index);
+    }
+
+    // Returns the first top level node of the members from the given
+    // one on, members without nodes are skipped
+    QXmlNodeModelIndex firstTopLevel(int id)
+    {
+        for (; id < entries.size(); ++id) {
+            Member member = load(id);
+            QXmlNodeModelIndex first = memberAxis(member, QAbstractXmlNodeModel::FirstChild, member->dom());
+            if (!first.isNull()) {
+                return fromMember(id, first);
+            }
+        }
+        return QXmlNodeModelIndex();
+    }
+
+    // Returns the last top level node of the members up to the given one
+    QXmlNodeModelIndex lastTopLevel(int id)
+    {
+        for (; id >= 0; --id) {
+            Member member = load(id);
+            QXmlNodeModelIndex last = memberAxis(member, QAbstractXmlNodeModel::FirstChild, member->dom());
+            if (last.isNull()) {
+                continue;
+            }
+            for (QXmlNodeModelIndex next = memberAxis(member, QAbstractXmlNodeModel::NextSibling, last); !next.isNull();
+                    next = memberAxis(member, QAbstractXmlNodeModel::NextSibling, last)) {
+                last = next;
+            }
+            return fromMember(id, last);
+        }
+        return QXmlNodeModelIndex();
+    }
+};
+
+/*!
+ * Constructs an empty collection at \a uri. Members added by addFile()
+ * are parsed with \a options when they are first visited by a query.
+ *
+ * The collection is one tree whose document node has the top level
+ * nodes of all members as children, in the order the members were
+ * added, so a query bound to dom() visits all of them in a single
+ * evaluation, for example \c{$dom/html/head/title}. Nodes of different
+ * members are ordered by the order of the members. documentUri() of a
+ * member node, and so its base URI, is the URI of the member.
+ *
+ * Members are frozen, and only the last maximumLoaded() visited members
+ * are kept in memory. Evicted members are loaded again when they are
+ * visited, from the snapshot cache if one is set. A collection could be
+ * queried from many threads at once, but members must not be added
+ * while it is queried.
+ */
+QLibXmlCollectionModel::QLibXmlCollectionModel(const QXmlNamePool &namePool, const QUrl &uri, const QLibXmlNodeModel::ParseOptions &options)
+    : QSimpleXmlNodeModel(namePool), d(new QLibXmlCollectionModelPrivate(this, uri, options))
+{
+}
+
+/*!
+ * Destructor
+ */
+QLibXmlCollectionModel::~QLibXmlCollectionModel()
+{
+    delete d;
+}
+
+/*!
+ * Adds the local file \a fileName as the last member, without loading
+ * it. Returns the number of the member.
+ */
+int QLibXmlCollectionModel::addFile(const QString &fileName)
+{
+    QMutexLocker locker(&d->mutex);
+    QLibXmlCollectionModelPrivate::Entry entry;
+    entry.fileName = fileName;
+    d->entries.append(entry);
+    return d->entries.size() - 1;
+}
+
+/*!
+ * Returns the number of members.
+ */
+int QLibXmlCollectionModel::memberCount() const
+{
+    return d->entries.size();
+}
+
+/*!
+ * Returns the URI of member \a id.
+ */
+QUrl QLibXmlCollectionModel::memberUri(int id) const
+{
+    return QUrl::fromLocalFile(d->entries.at(id).fileName);
+}
+
+/*!
+ * Returns the number of the member \a node belongs to, or -1 for the
+ * document node of the collection.
+ */
+int QLibXmlCollectionModel::memberOf(const QXmlNodeModelIndex &node) const
+{
+    return QLibXmlCollectionModelPrivate::memberOf(node);
+}
+
+/*!
+ * Returns true if member \a id is loaded.
+ */
+bool QLibXmlCollectionModel::isLoaded(int id) const
+{
+    QMutexLocker locker(&d->mutex);
+    return !d->entries.at(id).member.isNull();
+}
+
+/*!
+ * Returns the number of members kept loaded, 32 by default.
+ */
+int QLibXmlCollectionModel::maximumLoaded() const
+{
+    return d->maximumLoaded;
+}
+
+/*!
+ * Sets the number of members kept loaded to \a count. At least the
+ * member being visited is always loaded.
+ */
+void QLibXmlCollectionModel::setMaximumLoaded(int count)
+{
+    QMutexLocker locker(&d->mutex);
+    d->maximumLoaded = count;
+    d->evict();
+}
+
+/*!
+ * Loads members through \a cache, so a member parsed before, by this or
+ * another process, is opened from its snapshot. The cache has to live
+ * as long as the collection, NULL parses members every time.
+ */
+void QLibXmlCollectionModel::setSnapshotCache(const QLibXmlSnapshotCache *cache)
+{
+    QMutexLocker locker(&d->mutex);
+    d->cache = cache;
+}
+
+/*!
+ * Moves along \a axis from \a nodeIndex. The top level nodes of
+ * consecutive members are siblings, and their parent is the document
+ * node of the collection.
+ */
+QXmlNodeModelIndex
+QLibXmlCollectionModel::nextFromSimpleAxis(SimpleAxis axis, const QXmlNodeModelIndex &nodeIndex) const
+{
+    int id = d->memberOf(nodeIndex);
+    if (id < 0) {
+        return axis == FirstChild ? d->firstTopLevel(0) : QXmlNodeModelIndex();
+    }
+
+    QLibXmlCollectionModelPrivate::Member member = d->load(id);
+    QXmlNodeModelIndex node = d->toMember(member, nodeIndex);
+    QXmlNodeModelIndex next = d->memberAxis(member, axis, node);
+    if (!next.isNull()) {
+        if (member->kind(next) == QXmlNodeModelIndex::Document) {
+            return d->rootIndex();
+        }
+        return d->fromMember(id, next);
+    }
+
+    if (axis == NextSibling || axis == PreviousSibling) {
+        QXmlNodeModelIndex parent = d->memberAxis(member, Parent, node);
+        if (!parent.isNull() && member->kind(parent) == QXmlNodeModelIndex::Document) {
+            return axis == NextSibling ? d->firstTopLevel(id + 1) : d->lastTopLevel(id - 1);
+        }
+    }
+    return QXmlNodeModelIndex();
+}
+
+/*!
+ * Returns the URI of the member of \a node, or the URI of the
+ * collection for its document node.
+ */
+QUrl QLibXmlCollectionModel::documentUri(const QXmlNodeModelIndex &node) const
+{
+    int id = d->memberOf(node);
+    return id < 0 ? d->uri : memberUri(id);
+}
+
+/*!
+ * Returns the kind of \a nodeIndex.
+ */
+QXmlNodeModelIndex::NodeKind
+QLibXmlCollectionModel::kind(const QXmlNodeModelIndex &nodeIndex) const
+{
+    int id = d->memberOf(nodeIndex);
+    if (id < 0) {
+        return QXmlNodeModelIndex::Document;
+    }
+
+    QLibXmlCollectionModelPrivate::Member member = d->load(id);
+    return member->kind(d->toMember(member, nodeIndex));
+}
+
+/*!
+ * Orders nodes of different members by the order of the members, and
+ * nodes of one member by their order in the member.
+ */
+QXmlNodeModelIndex::DocumentOrder QLibXmlCollectionModel::compareOrder(const QXmlNodeModelIndex &nodeIndex1, const QXmlNodeModelIndex &nodeIndex2) const
+{
+    int id1 = d->memberOf(nodeIndex1);
+    int id2 = d->memberOf(nodeIndex2);
+    if (id1 < id2) {
+        return QXmlNodeModelIndex::Precedes;
+    }
+    if (id1 > id2) {
+        return QXmlNodeModelIndex::Follows;
+    }
+    if (id1 < 0) {
+        return QXmlNodeModelIndex::Is;
+    }
+
+    QLibXmlCollectionModelPrivate::Member member = d->load(id1);
+    return member->compareOrder(d->toMember(member, nodeIndex1), d->toMember(member, nodeIndex2));
+}
+
+/*!
+ * Returns the name of \a nodeIndex.
+ */
+QXmlName QLibXmlCollectionModel::name(const QXmlNodeModelIndex &nodeIndex) const
+{
+    int id = d->memberOf(nodeIndex);
+    if (id < 0) {
+        return QXmlName();
+    }
+
+    QLibXmlCollectionModelPrivate::Member member = d->load(id);
+    return member->name(d->toMember(member, nodeIndex));
+}
+
+/*!
+ * Returns the first element with the \a id attribute, looking through
+ * the members in order. Members which are not loaded are parsed, or
+ * opened from the snapshot cache, until one is found, so a lookup is
+ * O(collection): one which fails parses every member. They are not
+ * kept loaded, so a lookup does not evict the members being visited.
+ */
+QXmlNodeModelIndex QLibXmlCollectionModel::elementById(const QXmlName &id) const
+{
+    for (int i = 0; i < d->entries.size(); ++i) {
+        QLibXmlCollectionModelPrivate::Member member = d->visit(i);
+        QXmlNodeModelIndex element = member->elementById(id);
+        if (!element.isNull()) {
+            return d->fromMember(i, element);
+        }
+    }
+    return QXmlNodeModelIndex();
+}
+
+/*!
+ * Returns the document node of the collection, which is the root of
+ * all nodes.
+ */
+QXmlNodeModelIndex QLibXmlCollectionModel::root(const QXmlNodeModelIndex &nodeIndex) const
+{
+    Q_UNUSED(nodeIndex);
+    return d->rootIndex();
+}
+
+/*!
+ * Returns the typed value of \a nodeIndex, which is its string value.
+ */
+QVariant QLibXmlCollectionModel::typedValue(const QXmlNodeModelIndex &nodeIndex) const
+{
+    return stringValue(nodeIndex);
+}
+
+/*!
+ * Returns the attributes of \a nodeIndex.
+ */
+QVector<QXmlNodeModelIndex> QLibXmlCollectionModel::attributes(const QXmlNodeModelIndex &nodeIndex) const
+{
+    int id = d->memberOf(nodeIndex);
+    Q_ASSERT_X(id >= 0, Q_FUNC_INFO, "Invalid node");
+
+    QLibXmlCollectionModelPrivate::Member member = d->load(id);
+    QVector<QXmlNodeModelIndex> result = d->memberAttributes(member, d->toMember(member, nodeIndex));
+    for (int i = 0; i < result.size(); ++i) {
+        result[i] = d->fromMember(id, result.at(i));
+    }
+    return result;
+}
+
+/*!
+ * Returns the string value of \a nodeIndex. The string value of the
+ * document node of the collection is the text of all members, which
+ * parses every member which is not loaded, the same way as
+ * elementById() does.
+ */
+QString QLibXmlCollectionModel::stringValue(const QXmlNodeModelIndex &nodeIndex) const
+{
+    int id = d->memberOf(nodeIndex);
+    if (id >= 0) {
+        QLibXmlCollectionModelPrivate::Member member = d->load(id);
+        return member->stringValue(d->toMember(member, nodeIndex));
+    }
+
+    QString str;
+    for (int i = 0; i < d->entries.size(); ++i) {
+        QLibXmlCollectionModelPrivate::Member member = d->visit(i);
+        str += member->stringValue(member->dom());
+    }
+    return str;
+}
@@ -0,0 +1,86 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "qlibxmldictionary.h"
+#include "qlibxmldictionary_p.h"
+
+/*!
+ * Constructs a dictionary of strings which could be shared by many
+ * models. Names cached in the dictionary belong to \a namePool, so
+ * models parsed with the dictionary must use the same name pool.
+ */
+QLibXmlDictionary::QLibXmlDictionary(const QXmlNamePool &namePool)
+    : d(new QLibXmlDictionaryPrivate(namePool))
+{
+}
+
+/*!
+ * Constructs a copy of \a other. Copies share the same dictionary.
+ */
+QLibXmlDictionary::QLibXmlDictionary(const QLibXmlDictionary &other)
+    : d(other.d)
+{
+}
+
+/*!
+ * Destructor. The dictionary is freed with the last copy and the last
+ * document which uses it.
+ */
+QLibXmlDictionary::~QLibXmlDictionary()
+{
+}
+
+/*!
+ * Makes this object share the dictionary of \a other.
+ */
+QLibXmlDictionary &QLibXmlDictionary::operator=(const QLibXmlDictionary &other)
+{
+    d = other.d;
+    return *this;
+}
+
+/*!
+ * Returns the name pool names cached in the dictionary belong to.
+ */
+QXmlNamePool QLibXmlDictionary::namePool() const
+{
+    return d->namePool;
+}
+
+/*!
+ * Returns the number of strings in the shared dictionary.
+ */
+int QLibXmlDictionary::size() const
+{
+    QReadLocker locker(&d->lock);
+    return xmlDictSize(d->dict);
+}
@@ -0,0 +1,80 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QLIBXMLDICTIONARY_P_H
+#define QLIBXMLDICTIONARY_P_H
+
+#include <string.h>
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QSharedData>
+#include <QXmlName>
+#include <QXmlNamePool>
+
+#include <libxml/tree.h>
+
+// Returns true if both are the same name pool. QXmlNamePool has no
+// comparison, but it only holds a shared pointer to the pool, so copies
+// of one pool are equal byte by byte.
+inline bool qLibXmlSameNamePool(const QXmlNamePool &pool1, const QXmlNamePool &pool2)
+{
+    return memcmp(&pool1, &pool2, sizeof(QXmlNamePool)) == 0;
+}
+
+// Internal shared data of QLibXmlDictionary
+class QLibXmlDictionaryPrivate : public QSharedData
+{
+public:
+    QXmlNamePool namePool;
+
+    // Strings shared by all models. Parsers look strings up in it through
+    // a private sub-dictionary and only read it, new strings are added
+    // after parsing with the lock held for writing.
+    xmlDictPtr dict;
+    QReadWriteLock lock;
+
+    // Names made from strings of the shared dictionary
+    QHash<const xmlChar *, QXmlName> names;
+
+    QLibXmlDictionaryPrivate(const QXmlNamePool &namePool)
+        : namePool(namePool), dict(xmlDictCreate())
+    {
+    }
+
+    ~QLibXmlDictionaryPrivate()
+    {
+        xmlDictFree(dict);
+    }
+};
+
+#endif // QLIBXMLDICTIONARY_P_H
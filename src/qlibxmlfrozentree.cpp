@@ -0,0 +1,421 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "qlibxmlfrozentree_p.h"
+
+// Header of a snapshot of a tree. It is followed by the document URI
+// and the name table, as UTF-8 strings each preceded by its size, and
+// then by storage of the tree, aligned so it could be used in place.
+// Numbers are in the byte order of the writer, snapshots written on a
+// machine with another byte order are rejected.
+struct SnapshotHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 nodeCount;
+    quint32 nameCount;
+    quint32 storageOffset;
+    quint32 reserved;
+    quint64 storageSize;
+};
+
+static const char SnapshotMagic[8] = "QLXSNAP";
+
+// Bumped whenever the layout of the header or the storage changes
+static const quint32 SnapshotVersion = 2;
+
+static const quint32 SnapshotByteOrder = 0x01020304;
+static const int SnapshotAlignment = 16;
+
+// Returns the position of a node, which is its document order ordinal
+static quint32 position(const xmlNode *node)
+{
+    return (quint32)(qptrdiff)node->_private;
+}
+
+// Maps libxml node types the same way QLibXmlNodeModel::kind() does
+static quint8 nodeKind(const xmlNode *node)
+{
+    switch (node->type) {
+        case XML_ELEMENT_NODE:
+            return QXmlNodeModelIndex::Element;
+        case XML_ATTRIBUTE_NODE:
+            return QXmlNodeModelIndex::Attribute;
+        case XML_COMMENT_NODE:
+            return QXmlNodeModelIndex::Comment;
+        case XML_DOCUMENT_NODE:
+        case XML_HTML_DOCUMENT_NODE:
+            return QXmlNodeModelIndex::Document;
+        case XML_PI_NODE:
+            return QXmlNodeModelIndex::ProcessingInstruction;
+        default:
+            return QXmlNodeModelIndex::Text;
+    }
+}
+
+// Returns size of the arrays of a tree, the arenas follow them
+static qint64 arraysSize(quint32 nodeCount)
+{
+    return (6 * (qint64)nodeCount + 2 * ((qint64)nodeCount + 1)) * sizeof(quint32) + nodeCount;
+}
+
+// Appends the replacement text of an entity reference, which libxml
+// keeps below the entity declaration
+static void appendEntityContent(QByteArray &out, xmlNode *node)
+{
+    xmlChar *content = xmlNodeGetContent(node);
+    if (content) {
+        out.append((const char *)content);
+        xmlFree(content);
+    }
+}
+
+static void appendString(QByteArray &out, const QString &str)
+{
+    QByteArray utf8 = str.toUtf8();
+    quint32 size = utf8.size();
+    out.append((const char *)&size, sizeof(size));
+    out.append(utf8);
+}
+
+// Reads a string written by appendString() and moves past it
+static bool readString(const char *&cur, const char *end, QString *str)
+{
+    quint32 size;
+    if (end - cur < (qptrdiff)sizeof(size)) {
+        return false;
+    }
+    memcpy(&size, cur, sizeof(size));
+    cur += sizeof(size);
+    if ((quint64)(end - cur) < size) {
+        return false;
+    }
+    *str = qLibXmlFromUtf8(cur, size);
+    cur += size;
+    return true;
+}
+
+QLibXmlFrozenTree::QLibXmlFrozenTree()
+    : nodeCount(0), kinds(NULL), names(NULL), parents(NULL),
+      firstChildren(NULL), nextSiblings(NULL), previousSiblings(NULL),
+      subtreeEnds(NULL), textStarts(NULL), text(NULL),
+      valueStarts(NULL), values(NULL)
+{
+}
+
+// Drops the tree
+void QLibXmlFrozenTree::clear()
+{
+    *this = QLibXmlFrozenTree();
+}
+
+// Flattens the document. Nodes have to be numbered by their position
+// and their names have to be in the name cache.
+void QLibXmlFrozenTree::build(xmlDoc *doc, quint32 count, const QHash<const xmlChar *, QXmlName> &nameCache)
+{
+    clear();
+    if (doc == NULL || count == 0) {
+        return;
+    }
+
+    storage.fill(0, arraysSize(count));
+    quint32 *nameIds = (quint32 *)storage.data();
+    quint32 *parentPos = nameIds + count;
+    quint32 *childPos = parentPos + count;
+    quint32 *nextPos = childPos + count;
+    quint32 *prevPos = nextPos + count;
+    quint32 *endPos = prevPos + count;
+    quint32 *textPos = endPos + count;
+    quint32 *valuePos = textPos + count + 1;
+    quint8 *kindOf = (quint8 *)(valuePos + count + 1);
+
+    QHash<const xmlChar *, quint32> ids;
+    nameTable.append(QXmlName());
+
+    QByteArray textArena;
+    QByteArray valueArena;
+
+    xmlNode *top = (xmlNode *)doc;
+    xmlNode *cur = top;
+    while (cur != NULL) {
+        quint32 pos = position(cur);
+        quint8 kind = nodeKind(cur);
+
+        kindOf[pos] = kind;
+        parentPos[pos] = cur == top ? 0 : position(cur->parent);
+        nextPos[pos] = cur->next ? position(cur->next) : 0;
+        prevPos[pos] = cur->prev ? position(cur->prev) : 0;
+        textPos[pos] = textArena.size();
+        valuePos[pos] = valueArena.size();
+
+        if (kind == QXmlNodeModelIndex::Element || kind == QXmlNodeModelIndex::ProcessingInstruction) {
+            quint32 &id = ids[cur->name];
+            if (id == 0) {
+                id = nameTable.size();
+                nameTable.append(nameCache.value(cur->name));
+            }
+            nameIds[pos] = id;
+        }
+
+        if (cur->type == XML_TEXT_NODE || cur->type == XML_CDATA_SECTION_NODE) {
+            textArena.append((const char *)cur->content);
+        } else if (cur->type == XML_ENTITY_REF_NODE) {
+            appendEntityContent(textArena, cur);
+        } else if (kind == QXmlNodeModelIndex::Comment || kind == QXmlNodeModelIndex::ProcessingInstruction) {
+            valueArena.append((const char *)cur->content);
+        }
+
+        for (xmlAttr *attr = cur->type == XML_ELEMENT_NODE ? cur->properties : NULL; attr != NULL; attr = attr->next) {
+            quint32 attrPos = position((xmlNode *)attr);
+            kindOf[attrPos] = QXmlNodeModelIndex::Attribute;
+            parentPos[attrPos] = pos;
+            textPos[attrPos] = textArena.size();
+            valuePos[attrPos] = valueArena.size();
+
+            quint32 &id = ids[attr->name];
+            if (id == 0) {
+                id = nameTable.size();
+                nameTable.append(nameCache.value(attr->name));
+            }
+            nameIds[attrPos] = id;
+
+            for (xmlNode *child = attr->children; child != NULL; child = child->next) {
+                if (child->type == XML_TEXT_NODE && child->content) {
+                    valueArena.append((const char *)child->content);
+                } else if (child->type == XML_ENTITY_REF_NODE) {
+                    appendEntityContent(valueArena, child);
+                }
+            }
+        }
+
+        // Only the document and elements are descended into
+        if ((cur == top || cur->type == XML_ELEMENT_NODE) && cur->children) {
+            childPos[pos] = position(cur->children);
+            cur = cur->children;
+            continue;
+        }
+        while (cur != top && cur->next == NULL) {
+            cur = cur->parent;
+        }
+        cur = cur == top ? NULL : cur->next;
+    }
+
+    textPos[count] = textArena.size();
+    valuePos[count] = valueArena.size();
+
+    // A subtree ends where the next sibling starts, or where the subtree
+    // of the parent ends. Parents always come first.
+    endPos[0] = count;
+    for (quint32 pos = 1; pos < count; ++pos) {
+        if (kindOf[pos] == QXmlNodeModelIndex::Attribute) {
+            endPos[pos] = pos + 1;
+        } else if (nextPos[pos] != 0) {
+            endPos[pos] = nextPos[pos];
+        } else {
+            endPos[pos] = endPos[parentPos[pos]];
+        }
+    }
+
+    storage.append(textArena);
+    storage.append(valueArena);
+
+    // Storage could have moved while appending
+    setPointers(storage.constData(), count);
+}
+
+// Points arrays and arenas into storage of a tree laid out by build()
+void QLibXmlFrozenTree::setPointers(const char *data, quint32 count)
+{
+    nodeCount = count;
+    names = (const quint32 *)data;
+    parents = names + count;
+    firstChildren = parents + count;
+    nextSiblings = firstChildren + count;
+    previousSiblings = nextSiblings + count;
+    subtreeEnds = previousSiblings + count;
+    textStarts = subtreeEnds + count;
+    valueStarts = textStarts + count + 1;
+    kinds = (const quint8 *)(valueStarts + count + 1);
+    text = data + arraysSize(count);
+    values = text + textStarts[count];
+}
+
+// Writes a snapshot of the tree, which read() could map back without
+// building it again. Names are written as strings, as name pool codes
+// are only valid within the process.
+bool QLibXmlFrozenTree::write(QIODevice *device, const QString &uri, const QXmlNamePool &namePool) const
+{
+    if (isEmpty()) {
+        return false;
+    }
+
+    QByteArray head(sizeof(SnapshotHeader), 0);
+    appendString(head, uri);
+    for (int i = 1; i < nameTable.size(); ++i) {
+        appendString(head, nameTable.at(i).localName(namePool));
+    }
+    head.append(QByteArray((SnapshotAlignment - head.size() % SnapshotAlignment) % SnapshotAlignment, 0));
+
+    qint64 storageSize = arraysSize(nodeCount) + textStarts[nodeCount] + valueStarts[nodeCount];
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+    header.version = SnapshotVersion;
+    header.byteOrder = SnapshotByteOrder;
+    header.nodeCount = nodeCount;
+    header.nameCount = nameTable.size();
+    header.storageOffset = head.size();
+    header.storageSize = storageSize;
+    memcpy(head.data(), &header, sizeof(header));
+
+    // The arrays are the start of the storage
+    return device->write(head) == head.size()
+        && device->write((const char *)names, storageSize) == storageSize;
+}
+
+// Returns true if the kind is one a tree could have below the document
+static bool isChildKind(quint8 kind)
+{
+    switch (kind) {
+        case QXmlNodeModelIndex::Element:
+        case QXmlNodeModelIndex::Attribute:
+        case QXmlNodeModelIndex::Comment:
+        case QXmlNodeModelIndex::ProcessingInstruction:
+        case QXmlNodeModelIndex::Text:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Checks that every index and offset of the tree is in range, so that
+// a damaged snapshot could not make navigation read outside of it. Links
+// are also checked to point forward or backward the way build() lays
+// them out, so following them always ends.
+bool QLibXmlFrozenTree::isValid() const
+{
+    quint32 count = nodeCount;
+    if (kinds[0] != QXmlNodeModelIndex::Document || names[0] != 0 || parents[0] != 0
+            || nextSiblings[0] != 0 || previousSiblings[0] != 0 || subtreeEnds[0] != count
+            || (firstChildren[0] != 0 && firstChildren[0] >= count)) {
+        return false;
+    }
+
+    for (quint32 pos = 0; pos < count; ++pos) {
+        if (names[pos] >= (quint32)nameTable.size()
+                || textStarts[pos] > textStarts[pos + 1]
+                || valueStarts[pos] > valueStarts[pos + 1]) {
+            return false;
+        }
+        if (pos == 0) {
+            continue;
+        }
+        if (!isChildKind(kinds[pos])
+                || parents[pos] >= pos
+                || previousSiblings[pos] >= pos
+                || (nextSiblings[pos] != 0 && (nextSiblings[pos] <= pos || nextSiblings[pos] >= count))
+                || (firstChildren[pos] != 0 && (firstChildren[pos] <= pos || firstChildren[pos] >= count))
+                || subtreeEnds[pos] <= pos || subtreeEnds[pos] > count) {
+            return false;
+        }
+        if (kinds[pos] == QXmlNodeModelIndex::Attribute && kinds[parents[pos]] != QXmlNodeModelIndex::Element) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Points the tree into a snapshot written by write(), which has to stay
+// valid and unchanged while the tree is used. Every node is checked, see
+// isValid(), which is a single pass over the arrays and still much less
+// work than parsing the document again.
+bool QLibXmlFrozenTree::read(const char *data, qint64 size, const QXmlNamePool &namePool, QString *uri)
+{
+    clear();
+
+    SnapshotHeader header;
+    if (size < (qint64)sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) != 0
+            || header.version != SnapshotVersion
+            || header.byteOrder != SnapshotByteOrder) {
+        return false;
+    }
+    if (header.nodeCount == 0 || header.nameCount == 0
+            || header.storageOffset < sizeof(header) || header.storageOffset % SnapshotAlignment != 0
+            || header.storageOffset > size
+            || header.storageSize != (quint64)(size - header.storageOffset)
+            || (quint64)arraysSize(header.nodeCount) > header.storageSize) {
+        return false;
+    }
+    if ((qptrdiff)data % SnapshotAlignment != 0) {
+        return false;
+    }
+
+    const char *storageData = data + header.storageOffset;
+    const quint32 *starts = (const quint32 *)storageData + 6 * header.nodeCount;
+    quint64 textSize = starts[header.nodeCount];
+    quint64 valuesSize = starts[2 * header.nodeCount + 1];
+    if (arraysSize(header.nodeCount) + textSize + valuesSize != header.storageSize) {
+        return false;
+    }
+
+    const char *cur = data + sizeof(header);
+    const char *end = storageData;
+    QVector<QXmlName> table;
+    table.reserve(header.nameCount);
+    table.append(QXmlName());
+    if (!readString(cur, end, uri)) {
+        return false;
+    }
+    for (quint32 i = 1; i < header.nameCount; ++i) {
+        QString name;
+        if (!readString(cur, end, &name) || name.isEmpty()) {
+            return false;
+        }
+        table.append(QXmlName(namePool, name));
+    }
+
+    nameTable = table;
+    setPointers(storageData, header.nodeCount);
+    if (!isValid()) {
+        clear();
+        return false;
+    }
+    return true;
+}
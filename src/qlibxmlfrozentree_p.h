@@ -0,0 +1,126 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QLIBXMLFROZENTREE_P_H
+#define QLIBXMLFROZENTREE_P_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+#include <QXmlName>
+#include <QXmlNamePool>
+#include <QXmlNodeModelIndex>
+
+#include <libxml/tree.h>
+
+#include "qlibxmlutf8_p.h"
+
+// Document flattened into arrays in document order, with attributes
+// right after their owner element. A node is identified by its
+// position. The document is at position 0, which is never a child or
+// a sibling, so 0 also means that there is no such node.
+class QLibXmlFrozenTree
+{
+public:
+    quint32 nodeCount;
+
+    // QXmlNodeModelIndex::NodeKind of nodes
+    const quint8 *kinds;
+
+    // Indexes into nameTable, 0 for nodes without name
+    const quint32 *names;
+
+    const quint32 *parents;
+    const quint32 *firstChildren;
+    const quint32 *nextSiblings;
+    const quint32 *previousSiblings;
+
+    // Position following the subtree of a node
+    const quint32 *subtreeEnds;
+
+    // Text nodes are stored one after another in document order, so
+    // text below any node is one slice of the text arena. An entry is
+    // the size of text of all nodes before the position, there is one
+    // for the end of the document too.
+    const quint32 *textStarts;
+    const char *text;
+
+    // Values of attributes, comments and processing instructions,
+    // stored the same way
+    const quint32 *valueStarts;
+    const char *values;
+
+    QVector<QXmlName> nameTable;
+
+    QLibXmlFrozenTree();
+
+    bool isEmpty() const
+    {
+        return nodeCount == 0;
+    }
+
+    void clear();
+    void build(xmlDoc *doc, quint32 nodeCount, const QHash<const xmlChar *, QXmlName> &nameCache);
+
+    bool write(QIODevice *device, const QString &uri, const QXmlNamePool &namePool) const;
+    bool read(const char *data, qint64 size, const QXmlNamePool &namePool, QString *uri);
+
+    QXmlNodeModelIndex::NodeKind kind(quint32 pos) const
+    {
+        return (QXmlNodeModelIndex::NodeKind)kinds[pos];
+    }
+
+    // Returns concatenation of all text nodes in the subtree
+    QString textContent(quint32 pos) const
+    {
+        quint32 start = textStarts[pos];
+        return qLibXmlFromUtf8(text + start, textStarts[subtreeEnds[pos]] - start);
+    }
+
+    QString value(quint32 pos) const
+    {
+        quint32 start = valueStarts[pos];
+        return qLibXmlFromUtf8(values + start, valueStarts[pos + 1] - start);
+    }
+
+private:
+    void setPointers(const char *data, quint32 count);
+    bool isValid() const;
+
+    // Arrays followed by the arenas. Empty if the tree points into
+    // a mapped snapshot instead.
+    QByteArray storage;
+};
+
+#endif // QLIBXMLFROZENTREE_P_H
@@ -30,57 +30,1462 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <limits.h>
+#include <string.h>
+
+#if defined(Q_CC_MSVC) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+#include <QtGlobal>
+#if QT_VERSION >= 0x050300
+#include <QAtomicInteger>
+#endif
+#include <QCache>
 #include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QXmlQuery>
+#include <QXmlResultItems>
+
+#include <libxml/HTMLparser.h>
+#include <libxml/HTMLtree.h>
+#include <libxml/parser.h>
+#include <libxml/parserInternals.h>
+#include <libxml/tree.h>
+#include <libxml/valid.h>
+#include <libxml/xmlIO.h>
+#include <libxml/xpath.h>
+#include <libxml/xpathInternals.h>
+
+#include "qlibxmlnodemodel.h"
+#include "qlibxmlnodemodel_p.h"
+#include "qlibxmlarena_p.h"
+#include "qlibxmldictionary_p.h"
+#include "qlibxmlfrozentree_p.h"
+#include "qlibxmlutf8_p.h"
+
+// Number of strings in a model dictionary above which it is dropped
+// on reset instead of being kept for the next document
+static const int MaxRetainedStrings = 65536;
+
+// Initializes libxml once, when the library is loaded and before any
+// thread could create a model
+static struct LibXmlInit
+{
+    LibXmlInit()
+    {
+        xmlInitParser();
+    }
+} libXmlInit;
+
+// Returns time elapsed since the timer was started, in nanoseconds
+static qint64 nsecsElapsed(const QElapsedTimer &timer)
+{
+#if QT_VERSION >= 0x040800
+    return timer.nsecsElapsed();
+#else
+    return timer.elapsed() * 1000000;
+#endif
+}
+
+// Counter of accessor calls, 64-bit as calls and characters returned
+// overflow 32 bits on large documents and long runs. QAtomicInt is only
+// 32-bit in Qt 4, so compiler atomics are used where there are 64-bit
+// ones, and a mutex otherwise.
+class StatisticsCounter
+{
+public:
+    StatisticsCounter() : value(0) {}
+
+    void add(qint64 n)
+    {
+#if QT_VERSION >= 0x050300
+        value.fetchAndAddRelaxed(n);
+#elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)
+        __sync_fetch_and_add(&value, n);
+#elif defined(Q_CC_MSVC) && defined(_M_X64)
+        _InterlockedExchangeAdd64(&value, n);
+#else
+        QMutexLocker locker(&mutex);
+        value += n;
+#endif
+    }
+
+    // Returns the value and sets the counter to zero if reset is true
+    qint64 load(bool reset = false)
+    {
+#if QT_VERSION >= 0x050300
+        return reset ? value.fetchAndStoreRelaxed(0) : value.load();
+#elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)
+        return reset ? __sync_lock_test_and_set(&value, 0) : __sync_fetch_and_add(&value, 0);
+#elif defined(Q_CC_MSVC) && defined(_M_X64)
+        return reset ? _InterlockedExchange64(&value, 0) : _InterlockedExchangeAdd64(&value, 0);
+#else
+        QMutexLocker locker(&mutex);
+        qint64 result = value;
+        if (reset) {
+            value = 0;
+        }
+        return result;
+#endif
+    }
+
+private:
+#if QT_VERSION >= 0x050300
+    QAtomicInteger<qint64> value;
+#elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8)
+    qint64 value;
+#elif defined(Q_CC_MSVC) && defined(_M_X64)
+    volatile __int64 value;
+#else
+    qint64 value;
+    QMutex mutex;
+#endif
+};
+
+// Returns libxml parser options for the parse options
+int qLibXmlParserOptions(const QLibXmlNodeModel::ParseOptions &options)
+{
+    int result = 0;
+    if (options.mode == QLibXmlNodeModel::XmlParser) {
+        if (options.flags & QLibXmlNodeModel::CompactText) {
+            result |= XML_PARSE_COMPACT;
+        }
+        if (options.flags & QLibXmlNodeModel::StripBlankText) {
+            result |= XML_PARSE_NOBLANKS;
+        }
+        if (options.flags & QLibXmlNodeModel::SuppressErrors) {
+            result |= XML_PARSE_NOERROR | XML_PARSE_NOWARNING;
+        }
+        if (options.flags & QLibXmlNodeModel::NoNetwork) {
+            result |= XML_PARSE_NONET;
+        }
+        // Strings of the context dictionary must not be interned while
+        // an arena is current
+        if (options.flags & QLibXmlNodeModel::ArenaAllocation) {
+            result |= XML_PARSE_NODICT;
+        }
+    } else {
+        if (options.flags & QLibXmlNodeModel::CompactText) {
+            result |= HTML_PARSE_COMPACT;
+        }
+        if (options.flags & QLibXmlNodeModel::StripBlankText) {
+            result |= HTML_PARSE_NOBLANKS;
+        }
+        if (options.flags & QLibXmlNodeModel::SuppressErrors) {
+            result |= HTML_PARSE_NOERROR | HTML_PARSE_NOWARNING;
+        }
+        if (options.flags & QLibXmlNodeModel::NoNetwork) {
+            result |= HTML_PARSE_NONET;
+        }
+    }
+    return result;
+}
+
+void qLibXmlUseOptions(xmlParserCtxtPtr ctxt, const QLibXmlNodeModel::ParseOptions &options)
+{
+    if (options.mode == QLibXmlNodeModel::XmlParser) {
+        xmlCtxtUseOptions(ctxt, qLibXmlParserOptions(options));
+    } else {
+        htmlCtxtUseOptions(ctxt, qLibXmlParserOptions(options));
+    }
+
+    // Force encoding the same way htmlReadMemory() does
+    if (options.encoding.isEmpty()) {
+        return;
+    }
+    const char *encoding = options.encoding.constData();
+    xmlCharEncodingHandlerPtr handler = xmlFindCharEncodingHandler(encoding);
+    if (handler != NULL) {
+        xmlSwitchToEncoding(ctxt, handler);
+        if (options.mode == QLibXmlNodeModel::HtmlParser) {
+            if (ctxt->input->encoding != NULL) {
+                xmlFree((xmlChar *)ctxt->input->encoding);
+            }
+            ctxt->input->encoding = xmlStrdup((const xmlChar *)encoding);
+        }
+    }
+}
+
+void qLibXmlAddError(QStringList *errors, const QUrl &uri, const QLibXmlNodeModel::ParseOptions &options, xmlErrorPtr error)
+{
+    if (error == NULL || error->message == NULL) {
+        return;
+    }
+
+    QString message = QString("%1:%2: %3")
+        .arg(uri.toString())
+        .arg(error->line)
+        .arg(QString::fromUtf8(error->message).trimmed());
+
+    if (!(options.flags & QLibXmlNodeModel::SuppressErrors)) {
+        qDebug() << message;
+    }
+    if (errors->size() < MaxParseErrors) {
+        errors->append(message);
+    }
+}
+
+// Internal private data
+class QLibXmlNodeModelPrivate
+{
+public:
+    QLibXmlNodeModel *model;
+    QUrl uri;
+
+    QLibXmlNodeModel::ParseOptions options;
+
+    // Shared dictionary the document is parsed with, if any
+    QExplicitlySharedDataPointer<QLibXmlDictionaryPrivate> dictionary;
+
+    // Dictionary names of the document are interned in. It is a private
+    // sub-dictionary of the shared one if there is a shared one, so the
+    // shared dictionary is only read while parsing.
+    xmlDictPtr dict;
+
+    xmlDoc *doc;
+
+    // Number of nodes in the document, including attributes
+    qptrdiff nodeCount;
+
+    // Flattened document, the libxml one is freed when it is built
+    QLibXmlFrozenTree tree;
+
+    // Snapshot file the tree is mapped from, if it was opened from one
+    QFile *snapshot;
+
+    // Parser context retained between documents
+    xmlParserCtxtPtr ctxt;
+
+    // Parser context of an incremental parse in progress
+    xmlParserCtxtPtr pushCtxt;
+
+    // Element and attribute names interned in the document dictionary
+    QHash<const xmlChar *, QXmlName> names;
+
+    // Errors reported by the parser for the current document
+    QStringList errors;
+
+    // Elements by id, tag name and class, built on first lookup
+    struct Lookup
+    {
+        Lookup() : built(false) {}
+
+        bool built;
+        QHash<QString, QXmlNodeModelIndex> ids;
+        QHash<QXmlName, QVector<QXmlNodeModelIndex> > tags;
+        QHash<QString, QVector<QXmlNodeModelIndex> > classes;
+    };
+    Lookup lookup;
+    QMutex lookupMutex;
+
+    // Counters of accessor calls, allocated only with the
+    // CollectStatistics flag. Atomic, as models could be queried from
+    // many threads at once.
+    enum Counter {
+        ParentCalls,
+        FirstChildCalls,
+        PreviousSiblingCalls,
+        NextSiblingCalls,
+        CompareOrderCalls,
+        NameCalls,
+        KindCalls,
+        AttributesCalls,
+        StringValueCalls,
+        TypedValueCalls,
+        StringChars,
+        CounterCount
+    };
+    StatisticsCounter *counters;
+
+    // Time spent parsing the current document
+    qint64 parseNsecs;
+
+    // Arena tree nodes are allocated from with the ArenaAllocation flag,
+    // and default handlers of the parser building them
+    QLibXmlArena *arena;
+    xmlSAXHandler treeSax;
+
+    // String values by index data, the cost is the string length. Values
+    // are not cached if the capacity is 0.
+    QCache<qint64, QString> valueCache;
+    int cacheCapacity;
+    qint64 cacheHits;
+    qint64 cacheMisses;
+    QMutex cacheMutex;
+
+    QLibXmlNodeModelPrivate(QLibXmlNodeModel *model)
+        : model(model), dict(NULL), doc(NULL), nodeCount(0), snapshot(NULL), ctxt(NULL), pushCtxt(NULL),
+          counters(NULL), parseNsecs(0), arena(NULL), valueCache(0), cacheCapacity(0),
+          cacheHits(0), cacheMisses(0)
+    {
+    }
+
+    ~QLibXmlNodeModelPrivate()
+    {
+        clear();
+
+        if (ctxt) {
+            xmlFreeParserCtxt(ctxt);
+            ctxt = NULL;
+        }
+
+        xmlDictFree(dict);
+        dict = NULL;
+
+        delete[] counters;
+        delete arena;
+    }
+
+    // Frees the document
+    void clear()
+    {
+        if (pushCtxt) {
+            freeDocument(pushCtxt->myDoc);
+            pushCtxt->myDoc = NULL;
+            xmlFreeParserCtxt(pushCtxt);
+            pushCtxt = NULL;
+        }
+
+        freeDocument(doc);
+        doc = NULL;
+        nodeCount = 0;
+        parseNsecs = 0;
+        tree.clear();
+        delete snapshot;
+        snapshot = NULL;
+        lookup = Lookup();
+        clearValueCache();
+
+        errors.clear();
+    }
+
+    // The parser context, the dictionary and the name cache are kept
+    // for the next document, unless the dictionary has grown too big
+    void trimCaches()
+    {
+        if (dict != NULL && retainedStrings() > MaxRetainedStrings) {
+            if (ctxt) {
+                xmlFreeParserCtxt(ctxt);
+                ctxt = NULL;
+            }
+            names.clear();
+            xmlDictFree(dict);
+            dict = createDictionary();
+        }
+    }
+
+    // Returns the number of strings the model dictionary holds itself.
+    // The size of a sub-dictionary includes the shared one, which grows
+    // with all models using it.
+    int retainedStrings() const
+    {
+        int size = xmlDictSize(dict);
+        if (dictionary) {
+            QReadLocker locker(&dictionary->lock);
+            size -= xmlDictSize(dictionary->dict);
+        }
+        return size;
+    }
+
+    // Sets options used for parsing
+    // Documents built elsewhere come with their own dictionary and
+    // allocation, none is set up for them unless ownTree is set
+    void setOptions(const QLibXmlNodeModel::ParseOptions &parseOptions, bool ownTree = true)
+    {
+        options = parseOptions;
+        if (options.dictionary) {
+            // Names cached in the dictionary belong to its name pool, a
+            // dictionary of another pool is not used
+            bool samePool = qLibXmlSameNamePool(options.dictionary->d->namePool, model->namePool());
+            Q_ASSERT_X(samePool, Q_FUNC_INFO, "Dictionary belongs to another name pool");
+            if (samePool) {
+                dictionary = options.dictionary->d;
+            }
+            options.dictionary = NULL;
+        }
+
+        if (options.flags & QLibXmlNodeModel::CollectStatistics) {
+            counters = new StatisticsCounter[CounterCount];
+        }
+
+        if (!ownTree) {
+            return;
+        }
+        dict = createDictionary();
+
+        // The arena allocation functions are installed by the first
+        // model asking for them, without them documents are allocated
+        // as usual
+        if ((options.flags & QLibXmlNodeModel::ArenaAllocation) && QLibXmlArena::install()) {
+            arena = new QLibXmlArena;
+        }
+    }
+
+    // Frees a document. Documents allocated from the arena are dropped
+    // with it at once, only DTDs and id tables, which could hold blocks
+    // allocated by the parser outside of tree callbacks, are freed one
+    // by one.
+    void freeDocument(xmlDoc *document)
+    {
+        if (document == NULL) {
+            return;
+        }
+        if (arena == NULL) {
+            xmlFreeDoc(document);
+            return;
+        }
+
+        // Some nodes were allocated from the heap when the arena could
+        // not grow, the tree is freed node by node then. Freeing nodes
+        // of the arena does nothing.
+        if (arena->hasHeapBlocks()) {
+            xmlFreeDoc(document);
+            arena->reset();
+            return;
+        }
+
+        {
+            QLibXmlArena::Scope scope(arena);
+            if (document->extSubset != NULL && document->extSubset != document->intSubset) {
+                xmlFreeDtd(document->extSubset);
+            }
+            if (document->intSubset != NULL) {
+                xmlFreeDtd(document->intSubset);
+            }
+            if (document->ids != NULL) {
+                xmlFreeIDTable((xmlIDTablePtr)document->ids);
+            }
+            if (document->refs != NULL) {
+                xmlFreeRefTable((xmlRefTablePtr)document->refs);
+            }
+        }
+
+        // The reference taken by finishParse()
+        if (document->dict != NULL) {
+            xmlDictFree(document->dict);
+        }
+        arena->reset();
+    }
+
+    // Makes the parser context allocate tree nodes from the arena. Only
+    // handlers building the tree run with the arena current, so strings
+    // of dictionaries and tables of the context are allocated as usual.
+    void useArena(xmlParserCtxtPtr ctxt)
+    {
+        if (arena == NULL) {
+            return;
+        }
+
+        // Handlers not set by default are left unset
+        treeSax = *ctxt->sax;
+        xmlSAXHandler *sax = ctxt->sax;
+        if (sax->startDocument) {
+            sax->startDocument = arenaStartDocument;
+        }
+        if (sax->endDocument) {
+            sax->endDocument = arenaEndDocument;
+        }
+        if (sax->startElement) {
+            sax->startElement = arenaStartElement;
+        }
+        if (sax->startElementNs) {
+            sax->startElementNs = arenaStartElementNs;
+        }
+        if (sax->characters) {
+            sax->characters = arenaCharacters;
+        }
+        if (sax->ignorableWhitespace) {
+            // The parser looks for blanks only if both differ
+            sax->ignorableWhitespace = treeSax.ignorableWhitespace == treeSax.characters ? arenaCharacters : arenaIgnorableWhitespace;
+        }
+        if (sax->cdataBlock) {
+            sax->cdataBlock = arenaCdataBlock;
+        }
+        if (sax->comment) {
+            sax->comment = arenaComment;
+        }
+        if (sax->processingInstruction) {
+            sax->processingInstruction = arenaProcessingInstruction;
+        }
+        if (sax->reference) {
+            sax->reference = arenaReference;
+        }
+    }
+
+    static QLibXmlNodeModelPrivate *self(void *userData)
+    {
+        return (QLibXmlNodeModelPrivate *)((xmlParserCtxtPtr)userData)->_private;
+    }
+
+    // Makes the arena current while a tree handler runs
+    class TreeScope : public QLibXmlArena::TreeScope
+    {
+    public:
+        explicit TreeScope(void *userData)
+            : QLibXmlArena::TreeScope(self(userData)->arena, &((xmlParserCtxtPtr)userData)->lastError)
+        {
+        }
+    };
+
+    static void arenaStartDocument(void *userData)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.startDocument(userData);
+    }
+
+    static void arenaEndDocument(void *userData)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.endDocument(userData);
+    }
+
+    static void arenaStartElement(void *userData, const xmlChar *name, const xmlChar **atts)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.startElement(userData, name, atts);
+    }
+
+    static void arenaStartElementNs(void *userData, const xmlChar *localName, const xmlChar *prefix,
+                                    const xmlChar *uri, int namespaceCount, const xmlChar **namespaces,
+                                    int attributeCount, int defaultedCount, const xmlChar **attributes)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.startElementNs(userData, localName, prefix, uri, namespaceCount, namespaces,
+                                               attributeCount, defaultedCount, attributes);
+    }
+
+    static void arenaCharacters(void *userData, const xmlChar *ch, int len)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.characters(userData, ch, len);
+    }
+
+    static void arenaIgnorableWhitespace(void *userData, const xmlChar *ch, int len)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.ignorableWhitespace(userData, ch, len);
+    }
+
+    static void arenaCdataBlock(void *userData, const xmlChar *value, int len)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.cdataBlock(userData, value, len);
+    }
+
+    static void arenaComment(void *userData, const xmlChar *value)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.comment(userData, value);
+    }
+
+    static void arenaProcessingInstruction(void *userData, const xmlChar *target, const xmlChar *data)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.processingInstruction(userData, target, data);
+    }
+
+    static void arenaReference(void *userData, const xmlChar *name)
+    {
+        TreeScope scope(userData);
+        self(userData)->treeSax.reference(userData, name);
+    }
+
+    // Adds to a counter if statistics are collected
+    void count(Counter counter, int n = 1)
+    {
+        if (counters) {
+            counters[counter].add(n);
+        }
+    }
+
+    // Counts characters of a string value being returned
+    QString counted(const QString &str)
+    {
+        count(StringChars, str.size());
+        return str;
+    }
+
+    xmlDictPtr createDictionary() const
+    {
+        if (dictionary) {
+            return xmlDictCreateSub(dictionary->dict);
+        }
+        return xmlDictCreate();
+    }
+
+    // Returns encoding to force, NULL means autodetection
+    const char *encoding() const
+    {
+        return options.encoding.isEmpty() ? NULL : options.encoding.constData();
+    }
+
+    // Returns the retained parser context, creating it if needed
+    xmlParserCtxtPtr context()
+    {
+        if (ctxt != NULL) {
+            return ctxt;
+        }
+
+        if (options.mode == QLibXmlNodeModel::XmlParser) {
+            ctxt = xmlNewParserCtxt();
+        } else {
+            ctxt = htmlNewParserCtxt();
+        }
+        if (ctxt == NULL) {
+            qDebug() << "could not create parser context";
+            return NULL;
+        }
+
+        useDictionary(ctxt);
+        routeErrors(ctxt);
+        useArena(ctxt);
+        return ctxt;
+    }
+
+    // Makes the parser context intern strings in the model dictionary
+    void useDictionary(xmlParserCtxtPtr ctxt)
+    {
+        if (dict == NULL || ctxt->dict == dict) {
+            return;
+        }
+
+        // Strings compared by pointer have to come from the new dictionary
+        xmlDictFree(ctxt->dict);
+        ctxt->dict = dict;
+        xmlDictReference(dict);
+        ctxt->str_xml = xmlDictLookup(dict, BAD_CAST "xml", 3);
+        ctxt->str_xmlns = xmlDictLookup(dict, BAD_CAST "xmlns", 5);
+        ctxt->str_xml_ns = xmlDictLookup(dict, XML_XML_NAMESPACE, 36);
+    }
+
+    // Makes the parser context report errors to this model instead of
+    // the global libxml error handler. HTML contexts are set up with
+    // SAX1 handlers, libxml only uses the structured error handler of
+    // SAX2 ones.
+    void routeErrors(xmlParserCtxtPtr ctxt)
+    {
+        ctxt->_private = this;
+        ctxt->sax->serror = structuredError;
+        ctxt->sax->initialized = XML_SAX2_MAGIC;
+    }
+
+    static void structuredError(void *userData, xmlErrorPtr error)
+    {
+        xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)userData;
+        QLibXmlNodeModelPrivate *d = (QLibXmlNodeModelPrivate *)ctxt->_private;
+        if (d != NULL) {
+            qLibXmlAddError(&d->errors, d->uri, d->options, error);
+        }
+    }
+
+    // The shared dictionary is locked for reading while libxml could
+    // look strings up in it
+    void lockDictionary()
+    {
+        if (dictionary) {
+            dictionary->lock.lockForRead();
+        }
+    }
+
+    void unlockDictionary()
+    {
+        if (dictionary) {
+            dictionary->lock.unlock();
+        }
+    }
+
+    // Parses the given source tree
+    void parse(const char *data, int size)
+    {
+        // xmlCtxtReadMemory() frees documents which are not well-formed
+        // node by node, the push parser leaves them to the model
+        if (arena != NULL && options.mode == QLibXmlNodeModel::XmlParser) {
+            beginPush();
+            pushChunk(data, size, true);
+            return;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        lockDictionary();
+
+        // The context is reset by libxml before parsing. The source is
+        // read through a callback, xmlCtxtReadMemory() would copy it as
+        // a whole into the input buffer first.
+        MemorySource source = { data, size, 0 };
+        if (context() != NULL) {
+            if (options.mode == QLibXmlNodeModel::XmlParser) {
+                doc = xmlCtxtReadIO(ctxt, readMemory, closeMemory, &source, uri.toString().toUtf8(), encoding(), qLibXmlParserOptions(options));
+            } else {
+                doc = htmlCtxtReadIO(ctxt, readMemory, closeMemory, &source, uri.toString().toUtf8(), encoding(), qLibXmlParserOptions(options));
+            }
+        }
+
+        unlockDictionary();
+
+        if (doc == NULL) {
+            qDebug() << "could not parse source" << QByteArray::fromRawData(data, size);
+        } else {
+            finishParse();
+        }
+
+        parseNsecs += nsecsElapsed(timer);
+    }
+
+    // Source in memory read by libxml as if it were a stream
+    struct MemorySource
+    {
+        const char *data;
+        int size;
+        int pos;
+    };
+
+    static int readMemory(void *context, char *buffer, int len)
+    {
+        MemorySource *source = (MemorySource *)context;
+        int size = qMin(len, source->size - source->pos);
+        memcpy(buffer, source->data + source->pos, size);
+        source->pos += size;
+        return size;
+    }
+
+    static int closeMemory(void *)
+    {
+        return 0;
+    }
+
+    // Starts an incremental parse, source is given by pushChunk()
+    void beginPush()
+    {
+        lockDictionary();
+        beginPushLocked();
+        unlockDictionary();
+    }
+
+    void beginPushLocked()
+    {
+        if (options.mode == QLibXmlNodeModel::XmlParser) {
+            pushCtxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, uri.toString().toUtf8());
+        } else {
+            pushCtxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, uri.toString().toUtf8(), XML_CHAR_ENCODING_NONE);
+        }
+        if (pushCtxt == NULL) {
+            qDebug() << "could not create parser context";
+            return;
+        }
+
+        useDictionary(pushCtxt);
+        routeErrors(pushCtxt);
+
+        qLibXmlUseOptions(pushCtxt, options);
+        useArena(pushCtxt);
+    }
+
+    // Parses next chunk of source, terminate finishes the document
+    bool pushChunk(const char *data, int size, bool terminate)
+    {
+        if (pushCtxt == NULL) {
+            return false;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        lockDictionary();
+        if (options.mode == QLibXmlNodeModel::XmlParser) {
+            xmlParseChunk(pushCtxt, data, size, terminate);
+        } else {
+            htmlParseChunk(pushCtxt, data, size, terminate);
+        }
+        unlockDictionary();
+
+        if (!terminate) {
+            parseNsecs += nsecsElapsed(timer);
+            return true;
+        }
+
+        doc = pushCtxt->myDoc;
+        pushCtxt->myDoc = NULL;
+        xmlFreeParserCtxt(pushCtxt);
+        pushCtxt = NULL;
+
+        if (doc == NULL) {
+            qDebug() << "could not parse source" << uri;
+        } else {
+            finishParse();
+        }
+
+        parseNsecs += nsecsElapsed(timer);
+        return hasDocument();
+    }
+
+    // Prepares a freshly parsed document for querying
+    void finishParse()
+    {
+        // The HTML parser does not intern names, they are interned by
+        // indexNodes(), so the document has to know the dictionary
+        if (doc->dict == NULL && dict != NULL) {
+            doc->dict = dict;
+            xmlDictReference(dict);
+        }
+
+        if (options.flags & QLibXmlNodeModel::StripBlankText) {
+            stripBlankText();
+        }
+
+        lockDictionary();
+        indexNodes();
+        unlockDictionary();
+
+        if (dictionary) {
+            shareNames();
+        }
+
+        if (options.flags & QLibXmlNodeModel::Freeze) {
+            freeze();
+        }
+    }
+
+    // Flattens the document into the frozen tree and frees it
+    void freeze()
+    {
+        if (doc == NULL) {
+            return;
+        }
+
+        tree.build(doc, nodeCount, names);
+        freeDocument(doc);
+        doc = NULL;
+
+        // Indexes of the lookup tables and the cache have changed
+        QMutexLocker locker(&lookupMutex);
+        lookup = Lookup();
+        locker.unlock();
+        clearValueCache();
+    }
+
+    // Maps a snapshot written by QLibXmlNodeModel::saveSnapshot() and
+    // points the frozen tree into it
+    bool loadSnapshot(const QString &fileName)
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        QFile *file = new QFile(fileName);
+        uchar *data = NULL;
+        if (file->open(QIODevice::ReadOnly) && file->size() > 0) {
+            data = file->map(0, file->size());
+        }
+
+        QString uriString;
+        if (data == NULL || !tree.read((const char *)data, file->size(), model->namePool(), &uriString)) {
+            qDebug() << "could not load snapshot" << fileName;
+            tree.clear();
+            delete file;
+            return false;
+        }
+
+        snapshot = file;
+        uri = QUrl(uriString);
+        nodeCount = tree.nodeCount;
+        parseNsecs += nsecsElapsed(timer);
+        return true;
+    }
+
+    void clearValueCache()
+    {
+        QMutexLocker locker(&cacheMutex);
+        valueCache.clear();
+    }
+
+    // Builds the lookup tables if they are not built yet, the mutex has
+    // to be locked
+    void buildLookup()
+    {
+        if (lookup.built) {
+            return;
+        }
+        lookup.built = true;
+
+        if (isFrozen()) {
+            // Find ids of the attribute names first, names are few
+            quint32 idName = 0;
+            quint32 className = 0;
+            for (int i = 1; i < tree.nameTable.size(); ++i) {
+                QString name = tree.nameTable.at(i).localName(model->namePool());
+                if (name == "id") {
+                    idName = i;
+                } else if (name == "class") {
+                    className = i;
+                }
+            }
+
+            for (quint32 pos = 1; pos < tree.nodeCount; ++pos) {
+                if (tree.kind(pos) != QXmlNodeModelIndex::Element) {
+                    continue;
+                }
+                QXmlNodeModelIndex element = toFrozenIndex(pos);
+                lookup.tags[tree.nameTable.at(tree.names[pos])].append(element);
+
+                for (quint32 attr = pos + 1; attr < tree.nodeCount && tree.kind(attr) == QXmlNodeModelIndex::Attribute; ++attr) {
+                    if (tree.names[attr] == idName && idName != 0) {
+                        addId(element, tree.value(attr));
+                    } else if (tree.names[attr] == className && className != 0) {
+                        addClasses(element, tree.value(attr));
+                    }
+                }
+            }
+            return;
+        }
+
+        if (doc == NULL) {
+            return;
+        }
+
+        xmlNode *top = (xmlNode *)doc;
+        for (xmlNode *cur = top->children; cur != NULL; cur = nextDescendant(cur, top)) {
+            if (cur->type != XML_ELEMENT_NODE) {
+                continue;
+            }
+            QXmlNodeModelIndex element = toNodeIndex(cur);
+            lookup.tags[names.value(cur->name)].append(element);
+
+            for (xmlAttr *attr = cur->properties; attr != NULL; attr = attr->next) {
+                if (xmlStrEqual(attr->name, BAD_CAST "id")) {
+                    addId(element, textContent((xmlNode *)attr));
+                } else if (xmlStrEqual(attr->name, BAD_CAST "class")) {
+                    addClasses(element, textContent((xmlNode *)attr));
+                }
+            }
+        }
+    }
+
+    // The first element with an id wins, as in browsers
+    void addId(const QXmlNodeModelIndex &element, const QString &id)
+    {
+        if (!id.isEmpty() && !lookup.ids.contains(id)) {
+            lookup.ids.insert(id, element);
+        }
+    }
+
+    void addClasses(const QXmlNodeModelIndex &element, const QString &value)
+    {
+        QStringList classes = value.simplified().split(' ', QString::SkipEmptyParts);
+        for (int i = 0; i < classes.size(); ++i) {
+            // A class could be repeated in the attribute
+            QVector<QXmlNodeModelIndex> &elements = lookup.classes[classes.at(i)];
+            if (elements.isEmpty() || elements.last() != element) {
+                elements.append(element);
+            }
+        }
+    }
+
+    bool isFrozen() const
+    {
+        return !tree.isEmpty();
+    }
+
+    bool hasDocument() const
+    {
+        return doc != NULL || isFrozen();
+    }
+
+    // Adds names of this document to the shared dictionary, so following
+    // documents find them there. Skipped if other models are parsing
+    // right now, the names will be added by a later model.
+    void shareNames()
+    {
+        if (!dictionary->lock.tryLockForWrite()) {
+            return;
+        }
+
+        QHash<const xmlChar *, QXmlName>::const_iterator i;
+        for (i = names.constBegin(); i != names.constEnd(); ++i) {
+            if (!xmlDictOwns(dictionary->dict, i.key())) {
+                const xmlChar *shared = xmlDictLookup(dictionary->dict, i.key(), -1);
+                if (shared != NULL) {
+                    dictionary->names.insert(shared, i.value());
+                }
+            }
+        }
+
+        dictionary->lock.unlock();
+    }
+
+    // Removes whitespace-only text nodes, which libxml keeps in many
+    // places even with the NOBLANKS option
+    void stripBlankText()
+    {
+        xmlNode *top = (xmlNode *)doc;
+        xmlNode *cur = top->children;
+        while (cur != NULL) {
+            xmlNode *next = nextDescendant(cur, top);
+            if (cur->type == XML_TEXT_NODE && xmlIsBlankNode(cur)) {
+                // Freeing nodes of the arena does nothing, they are
+                // dropped with the document
+                xmlUnlinkNode(cur);
+                xmlFreeNode(cur);
+            }
+            cur = next;
+        }
+    }
+
+    // Returns true if waitForReadyRead() of a sequential device blocks
+    // until data comes or the read channel is closed. The default one
+    // returns false at once, which is not the end of the source.
+    static bool canWait(QIODevice *device)
+    {
+        return device->inherits("QAbstractSocket") ||
+            device->inherits("QLocalSocket") ||
+            device->inherits("QProcess") ||
+            device->inherits("QSerialPort");
+    }
+
+    // Parses the source read from a device chunk by chunk
+    void parse(QIODevice *device)
+    {
+        beginPush();
+
+        char buf[ChunkSize];
+        bool truncated = false;
+        forever {
+            qint64 size = device->read(buf, sizeof(buf));
+            if (size > 0) {
+                pushChunk(buf, size, false);
+            } else if (size < 0) {
+                break;
+            } else if (!device->waitForReadyRead(-1)) {
+                truncated = device->isSequential() && device->isOpen() && !canWait(device);
+                break;
+            }
+        }
+
+        pushChunk(NULL, 0, true);
+
+        if (truncated) {
+            QString message = QString("%1: could not wait for more data from the device, the source could be truncated")
+                .arg(uri.toString());
+            if (!(options.flags & QLibXmlNodeModel::SuppressErrors)) {
+                qDebug() << message;
+            }
+            errors.append(message);
+        }
+    }
+
+    // Parses a file mapping it into memory. Static input buffers of
+    // libxml would avoid copying the mapping at all, but libxml 2.9
+    // reads past their end, so the mapping is read chunk by chunk.
+    void parse(const QString &fileName)
+    {
+        QFile file(fileName);
+        if (!file.open(QIODevice::ReadOnly)) {
+            qDebug() << "could not open file" << fileName;
+            return;
+        }
+
+        // Files which could not be mapped as a whole are streamed
+        qint64 size = file.size();
+        uchar *data = NULL;
+        if (size > 0 && size <= INT_MAX) {
+            data = file.map(0, size);
+        }
+        if (data == NULL) {
+            parse(&file);
+            return;
+        }
+
+        parse((const char *)data, size);
+        file.unmap(data);
+    }
+
+    // Takes a document built by libxml elsewhere. Names of the document
+    // could be interned in its dictionary, which is then used instead of
+    // the model one.
+    void adopt(xmlDoc *document)
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        // Names are interned in the dictionary of the document, if it
+        // has one
+        if (document->dict != NULL) {
+            dict = document->dict;
+            xmlDictReference(dict);
+        } else {
+            dict = createDictionary();
+        }
+        doc = document;
+        finishParse();
+
+        parseNsecs += nsecsElapsed(timer);
+    }
+
+    // Numbers all nodes in document order, storing ordinals in the
+    // application data field of libxml nodes. The document gets 0,
+    // attributes are numbered right after their owner element.
+    // Also interns names and fills the name cache on the way.
+    void indexNodes()
+    {
+        qptrdiff ordinal = 0;
+        doc->_private = (void *)ordinal++;
+
+        xmlNode *cur = doc->children;
+        while (cur != NULL) {
+            cur->_private = (void *)ordinal++;
+
+            if (cur->type == XML_ELEMENT_NODE) {
+                internName(&cur->name);
+                for (xmlAttr *attr = cur->properties; attr != NULL; attr = attr->next) {
+                    attr->_private = (void *)ordinal++;
+                    internName(&attr->name);
+                }
+
+                if (cur->children) {
+                    cur = cur->children;
+                    continue;
+                }
+            }
+
+            if (cur->type == XML_PI_NODE) {
+                internName(&cur->name);
+            }
+
+            // Go up until there is a following sibling
+            while (cur != NULL && cur->next == NULL) {
+                cur = cur->parent;
+                if (cur == (xmlNode *)doc) {
+                    cur = NULL;
+                }
+            }
+            if (cur != NULL) {
+                cur = cur->next;
+            }
+        }
+
+        nodeCount = ordinal;
+    }
+
+    // Replaces a node name with the one from the document dictionary
+    // and caches it. The HTML parser copies names per node instead of
+    // interning them, so the cache keyed on name pointers only has one
+    // entry per distinct name because of this. Names which could not be
+    // interned are not cached, name() builds them on the fly.
+    void internName(const xmlChar **name)
+    {
+        if (dict == NULL) {
+            return;
+        }
+
+        const xmlChar *interned = xmlDictLookup(dict, *name, -1);
+        if (interned == NULL) {
+            return;
+        }
+        if (interned != *name) {
+            // Names allocated from the arena stay in it
+            xmlFree((xmlChar *)*name);
+            *name = interned;
+        }
+        cacheName(interned);
+    }
+
+    // Adds a name to the name cache. Names are interned, so the pointer
+    // itself identifies the name. Names from the shared dictionary are
+    // taken from its cache.
+    void cacheName(const xmlChar *name)
+    {
+        QXmlName &cached = names[name];
+        if (cached.isNull() && dictionary) {
+            cached = dictionary->names.value(name);
+        }
+        if (cached.isNull()) {
+            cached = QXmlName(model->namePool(), qLibXmlFromUtf8((const char *)name));
+        }
+    }
+
+    // Returns the node following cur in document order, staying inside
+    // the subtree of top. Only elements are descended into.
+    static xmlNode *nextDescendant(xmlNode *cur, xmlNode *top)
+    {
+        if (cur->type == XML_ELEMENT_NODE && cur->children) {
+            return cur->children;
+        }
+        while (cur != top && cur->next == NULL) {
+            cur = cur->parent;
+        }
+        return cur == top ? NULL : cur->next;
+    }
+
+    static bool isText(xmlNode *node)
+    {
+        return (node->type == XML_TEXT_NODE || node->type == XML_CDATA_SECTION_NODE) && node->content;
+    }
+
+    // Returns content of a node copied by libxml, which resolves entity
+    // references to their replacement text
+    static QString resolvedContent(xmlNode *node)
+    {
+        xmlChar *content = xmlNodeGetContent(node);
+        QString str = qLibXmlFromUtf8((const char *)content);
+        xmlFree(content);
+        return str;
+    }
+
+    // Returns concatenation of all text nodes below top. The total
+    // length is measured first, so the nodes are decoded straight into
+    // the result. Entity references are left to libxml, their text is
+    // kept below the entity declaration.
+    static QString textContent(xmlNode *top)
+    {
+        xmlNode *single = NULL;
+        int count = 0;
+        int size = 0;
+        for (xmlNode *cur = top->children; cur != NULL; cur = nextDescendant(cur, top)) {
+            if (cur->type == XML_ENTITY_REF_NODE) {
+                return resolvedContent(top);
+            }
+            if (isText(cur)) {
+                single = cur;
+                ++count;
+                size += xmlStrlen(cur->content);
+            }
+        }
+
+        if (count == 0) {
+            return QString();
+        }
+        if (count == 1) {
+            return qLibXmlFromUtf8((const char *)single->content, size);
+        }
+
+        QString result;
+        result.resize(size);
+        ushort *out = (ushort *)result.data();
+        int length = 0;
+        for (xmlNode *cur = top->children; cur != NULL; cur = nextDescendant(cur, top)) {
+            if (isText(cur)) {
+                length += qLibXmlDecodeUtf8((const char *)cur->content, xmlStrlen(cur->content), out + length);
+            }
+        }
+        result.resize(length);
+        return result;
+    }
+
+    // Evaluates an XPath 1.0 expression with libxml, with the document
+    // as the context node and bound to $dom. Returns NULL if it is not
+    // an XPath 1.0 expression or could not be evaluated.
+    xmlXPathObjectPtr evaluateXPath(const QString &expression) const
+    {
+        if (doc == NULL) {
+            return NULL;
+        }
+
+        xmlXPathContextPtr xpathCtxt = xmlXPathNewContext(doc);
+        if (xpathCtxt == NULL) {
+            return NULL;
+        }
+        xpathCtxt->node = (xmlNode *)doc;
+        xpathCtxt->error = ignoreXPathError;
+        xmlXPathRegisterVariable(xpathCtxt, BAD_CAST "dom", xmlXPathNewNodeSet((xmlNode *)doc));
+
+        xmlXPathObjectPtr result = NULL;
+        xmlXPathCompExprPtr comp = xmlXPathCtxtCompile(xpathCtxt, BAD_CAST expression.toUtf8().constData());
+        if (comp != NULL) {
+            result = xmlXPathCompiledEval(comp, xpathCtxt);
+            xmlXPathFreeCompExpr(comp);
+        }
+
+        xmlXPathFreeContext(xpathCtxt);
+        return result;
+    }
+
+    // Errors only mean that the expression is left to QXmlQuery
+    static void ignoreXPathError(void *userData, xmlErrorPtr error)
+    {
+        Q_UNUSED(userData);
+        Q_UNUSED(error);
+    }
+
+    // Evaluates an expression with QXmlQuery, the same way as libxml
+    // does in evaluateXPath()
+    bool evaluateQuery(const QString &expression, QXmlResultItems *items) const
+    {
+        QXmlQuery query(model->namePool());
+        query.bindVariable("dom", model->dom());
+        query.setFocus(model->dom());
+        query.setQuery(expression, uri);
+        if (!query.isValid()) {
+            return false;
+        }
+
+        query.evaluateTo(items);
+        return true;
+    }
+
+    // Returns document order ordinal of a node
+    static qptrdiff ordinal(xmlNode *node)
+    {
+        return (qptrdiff)node->_private;
+    }
+
+    // Converts a model index to a position in the frozen tree
+    static quint32 toPosition(const QXmlNodeModelIndex &index)
+    {
+        return (quint32)index.data();
+    }
+
+    // Returns the string value of a node, taking it from the value cache
+    // if the cache is enabled
+    QString cachedValue(const QXmlNodeModelIndex &index)
+    {
+        if (cacheCapacity == 0) {
+            return value(index);
+        }
+
+        QMutexLocker locker(&cacheMutex);
+        QString *cached = valueCache.object(index.data());
+        if (cached) {
+            ++cacheHits;
+            return *cached;
+        }
+        ++cacheMisses;
+        locker.unlock();
+
+        QString str = value(index);
+
+        // Strings larger than the cache are not inserted
+        locker.relock();
+        valueCache.insert(index.data(), new QString(str), str.size() + 1);
+        return str;
+    }
+
+    // Returns the string value of a node
+    QString value(const QXmlNodeModelIndex &index) const
+    {
+        if (isFrozen()) {
+            return frozenStringValue(toPosition(index));
+        }
+
+        xmlNode *node = toNode(index);
+        if (!node) {
+            //qDebug() << "Invalid node";
+            return QString();
+        }
+
+        // Content is decoded in place, xmlNodeGetContent() would copy it
+        if (node->type == XML_TEXT_NODE ||
+            node->type == XML_CDATA_SECTION_NODE ||
+            node->type == XML_COMMENT_NODE ||
+            node->type == XML_PI_NODE) {
+            return qLibXmlFromUtf8((const char *)node->content);
+        }
+
+        if (node->type == XML_ELEMENT_NODE ||
+            node->type == XML_ATTRIBUTE_NODE ||
+            node->type == XML_DOCUMENT_NODE ||
+            node->type == XML_HTML_DOCUMENT_NODE) {
+            return textContent(node);
+        }
 
-#include <libxml/HTMLparser.h>
-#include <libxml/tree.h>
+        // Entity references, which kind() reports as text, have the
+        // replacement text of the entity as value
+        if (node->type == XML_ENTITY_REF_NODE) {
+            return resolvedContent(node);
+        }
 
-#include "qlibxmlnodemodel.h"
+        // Other nodes, such as DTDs, have no value in the data model
+        return QString();
+    }
 
-// Internal private data
-class QLibXmlNodeModelPrivate
-{
-public:
-    QLibXmlNodeModel *model;
-    QUrl uri;
+    // Returns the string value of a node in the frozen tree
+    QString frozenStringValue(quint32 pos) const
+    {
+        switch (tree.kind(pos)) {
+            case QXmlNodeModelIndex::Attribute:
+            case QXmlNodeModelIndex::Comment:
+            case QXmlNodeModelIndex::ProcessingInstruction:
+                return tree.value(pos);
+            default:
+                return tree.textContent(pos);
+        }
+    }
 
-    xmlDoc *doc;
+    // Converts a position in the frozen tree to a model index, position
+    // 0 is the document, like the null pointer is for libxml nodes
+    QXmlNodeModelIndex toFrozenIndex(quint32 pos) const
+    {
+        return model->createIndex((qint64)pos);
+    }
 
-    QLibXmlNodeModelPrivate(QLibXmlNodeModel *model)
-        : model(model), doc(NULL)
+    // Output callback of xmlOutputBuffer writing to a QIODevice
+    static int writeToDevice(void *context, const char *buffer, int len)
     {
+        QIODevice *device = (QIODevice *)context;
+        return device->write(buffer, len) == len ? len : -1;
     }
 
-    ~QLibXmlNodeModelPrivate()
+    // Writes the node as markup, the HTML way for HTML documents
+    void dumpNode(xmlOutputBufferPtr buf, xmlNode *node) const
     {
-        xmlFreeDoc(doc);
-        doc = NULL;
+        if (doc->type == XML_HTML_DOCUMENT_NODE) {
+            htmlNodeDumpFormatOutput(buf, doc, node, "UTF-8", 0);
+        } else {
+            xmlNodeDumpOutput(buf, doc, node, 0, 0, "UTF-8");
+        }
     }
 
-    // Parses the given source tree
-    void parse(const QByteArray &source)
+    // Writes the subtree of the node to the device through an output
+    // buffer. Documents are written as their children, so there is no
+    // XML declaration or doctype, like from QXmlSerializer.
+    bool serialize(xmlNode *node, QIODevice *device) const
     {
-        doc = htmlReadMemory(source.data(), source.size(), uri.toString().toUtf8(), "utf-8", 0);
+        xmlOutputBufferPtr buf = xmlOutputBufferCreateIO(writeToDevice, NULL, device, NULL);
+        if (buf == NULL) {
+            return false;
+        }
 
-        if (doc == NULL) {
-            qDebug() << "could not parse source" << source;
+        if (node == (xmlNode *)doc) {
+            for (xmlNode *cur = doc->children; cur != NULL; cur = cur->next) {
+                // The internal subset is the doctype
+                if (cur->type != XML_DTD_NODE) {
+                    dumpNode(buf, cur);
+                }
+            }
+        } else {
+            dumpNode(buf, node);
         }
+
+        return xmlOutputBufferClose(buf) >= 0;
     }
 
-    // Converts a model index to a HTML node
+    // Converts a model index to a HTML node. The document is indexed
+    // by a null pointer, so its index stays valid when the model is
+    // reset to another document.
     xmlNode *toNode(const QXmlNodeModelIndex &index) const
     {
-        return (xmlNode *)index.internalPointer();
+        xmlNode *node = (xmlNode *)index.internalPointer();
+        return node ? node : (xmlNode *)doc;
     }
 
     // Converts a HTML node to a model index
     QXmlNodeModelIndex toNodeIndex(xmlNode *node) const
     {
+        if (node == (xmlNode *)doc) {
+            return model->createIndex((void *)NULL);
+        }
         return model->createIndex((void *)node);
     }
     QXmlNodeModelIndex toNodeIndex(xmlDoc *node) const
     {
-        return model->createIndex((void *)node);
+        Q_UNUSED(node);
+        return model->createIndex((void *)NULL);
     }
     QXmlNodeModelIndex toNodeIndex(xmlAttr *node) const
     {
@@ -88,28 +1493,98 @@ public:
     }
 };
 
-void libXmlErrorFunc(void *ctx, const char *msg, ...)
+/*!
+ * Constructor passes \a pool to the base class. The \a source is parsed
+ * as described by \a options.
+ *
+ * Models keep no global state, so different models could be constructed
+ * and queried on different threads at the same time. A parsed model is
+ * not changed by queries and could be queried from many threads at once.
+ *
+ * With the ArenaAllocation flag nodes of the document are allocated from
+ * an arena of the model, which is dropped at once when the document is
+ * freed and reused for the next one by reset(). For this the first
+ * model with the flag replaces the libxml allocation functions of the
+ * process with ones which allocate from the heap unless a model is
+ * building a tree on the calling thread. If another library replaces
+ * them later, the flag is ignored.
+ */
+QLibXmlNodeModel::QLibXmlNodeModel(const QXmlNamePool& namePool, const QByteArray &source, const QUrl &uri, const ParseOptions &options)
+    : QSimpleXmlNodeModel(namePool), d(new QLibXmlNodeModelPrivate(this))
 {
-   char buf[1024];
-   va_list args;
-   va_start(args, msg);
-   vsnprintf(buf, 1024, msg, args);
-   va_end(args);
+    d->setOptions(options);
+    d->uri = uri;
+    d->parse(source.constData(), source.size());
+}
 
-   qDebug() << buf;
-   return;
+/*!
+ * Constructs a model reading the document from \a device. The source
+ * is parsed incrementally while it is being read, so it is never held
+ * in memory as a whole. Sequential devices such as sockets and
+ * processes are read until they are closed.
+ *
+ * Sequential devices which could not block waiting for data, such as
+ * QNetworkReply, are only read as far as data is available, and a
+ * parse error is recorded if they are still open then. Sources from
+ * such devices have to be given to a model made by createIncremental()
+ * with feed() as data arrives, and finish() at the end.
+ */
+QLibXmlNodeModel::QLibXmlNodeModel(const QXmlNamePool& namePool, QIODevice *device, const QUrl &uri, const ParseOptions &options)
+    : QSimpleXmlNodeModel(namePool), d(new QLibXmlNodeModelPrivate(this))
+{
+    d->setOptions(options);
+    d->uri = uri;
+    d->parse(device);
 }
 
 /*!
- * Constructor passes \a pool to the base class
+ * Constructs a model for the local file \a fileName. The file is
+ * mapped into memory and handed to the parser in small chunks, so it
+ * is never copied as a whole.
  */
-QLibXmlNodeModel::QLibXmlNodeModel(const QXmlNamePool& namePool, const QByteArray &source, const QUrl &uri)
+QLibXmlNodeModel::QLibXmlNodeModel(const QXmlNamePool& namePool, const QString &fileName, const ParseOptions &options)
     : QSimpleXmlNodeModel(namePool), d(new QLibXmlNodeModelPrivate(this))
 {
-    xmlSetGenericErrorFunc(NULL, libXmlErrorFunc);
+    d->setOptions(options);
+    d->uri = QUrl::fromLocalFile(fileName);
+    d->parse(fileName);
+}
+
+/*!
+ * Creates an empty model for the document at \a uri. The source has
+ * to be given in chunks by feed(), then finish() has to be called
+ * before the model could be queried. It is not a constructor, so that
+ * a file name could not be taken for the URI of an empty model.
+ *
+ * Returns a new model the caller takes ownership of.
+ */
+QLibXmlNodeModel *QLibXmlNodeModel::createIncremental(const QXmlNamePool &namePool, const QUrl &uri, const ParseOptions &options)
+{
+    QLibXmlNodeModel *model = new QLibXmlNodeModel(namePool, options);
+    model->d->uri = uri;
+    model->d->beginPush();
+    return model;
+}
 
+/*!
+ * Constructs a model for \a doc, which the model takes ownership of.
+ * Used for fragments of streamed documents, see QLibXmlStreamExtractor.
+ */
+QLibXmlNodeModel::QLibXmlNodeModel(const QXmlNamePool& namePool, xmlDoc *doc, const QUrl &uri, const ParseOptions &options)
+    : QSimpleXmlNodeModel(namePool), d(new QLibXmlNodeModelPrivate(this))
+{
+    d->setOptions(options, false);
     d->uri = uri;
-    d->parse(source);
+    d->adopt(doc);
+}
+
+/*!
+ * Constructs an empty model, see openSnapshot() and createIncremental()
+ */
+QLibXmlNodeModel::QLibXmlNodeModel(const QXmlNamePool& namePool, const ParseOptions &options)
+    : QSimpleXmlNodeModel(namePool), d(new QLibXmlNodeModelPrivate(this))
+{
+    d->setOptions(options);
 }
 
 /*!
@@ -120,6 +1595,356 @@ QLibXmlNodeModel::~QLibXmlNodeModel()
     delete d;
 }
 
+/*!
+ * Replaces the document of the model with the one parsed from \a source.
+ * Parse options are kept. The parser context and caches of the model are
+ * reused, and the index of the document node does not change, so a query
+ * bound to dom() could be evaluated again for the new document. Indexes
+ * of other nodes become invalid. Returns true if the document was parsed.
+ */
+bool QLibXmlNodeModel::reset(const QByteArray &source, const QUrl &uri)
+{
+    d->clear();
+    d->trimCaches();
+
+    d->uri = uri;
+    d->parse(source.constData(), source.size());
+    return d->hasDocument();
+}
+
+/*!
+ * Returns errors reported by the parser for the current document, up
+ * to the first hundred. Errors are collected even if they are not
+ * printed because of the SuppressErrors flag.
+ */
+QStringList QLibXmlNodeModel::parseErrors() const
+{
+    return d->errors;
+}
+
+/*!
+ * Flattens the document into compact arrays and frees the libxml tree.
+ * The frozen model is navigated faster and takes less memory, but it
+ * could not be evaluated by libxml anymore. Indexes of nodes other than
+ * the document become invalid. The Freeze flag freezes the model right
+ * after parsing.
+ */
+void QLibXmlNodeModel::freeze()
+{
+    d->freeze();
+}
+
+/*!
+ * Returns true if the model is frozen.
+ */
+bool QLibXmlNodeModel::isFrozen() const
+{
+    return d->isFrozen();
+}
+
+/*!
+ * Writes a snapshot of the document to \a device, which must be open
+ * for writing. The snapshot is the frozen tree as it is laid out in
+ * memory, so openSnapshot() maps it back without parsing the document
+ * again. Models which are not frozen are flattened into a temporary
+ * tree first. Snapshots are only read on machines with the same byte
+ * order and by the same snapshot format version, see
+ * QLibXmlSnapshotCache for keeping them. Returns false if there is no
+ * document or it could not be written.
+ */
+bool QLibXmlNodeModel::saveSnapshot(QIODevice *device) const
+{
+    QString uri = d->uri.toString();
+    if (d->isFrozen()) {
+        return d->tree.write(device, uri, namePool());
+    }
+    if (d->doc == NULL) {
+        return false;
+    }
+
+    QLibXmlFrozenTree tree;
+    tree.build(d->doc, d->nodeCount, d->names);
+    return tree.write(device, uri, namePool());
+}
+
+/*!
+ * Opens a snapshot written by saveSnapshot() to \a fileName. The file
+ * is mapped into memory and the model is navigated in place. Opening
+ * checks every node once, so a damaged snapshot is rejected, but
+ * nothing is parsed or allocated per node. The model is frozen and has
+ * the URI of the saved one, time spent opening it is reported as parse
+ * time. Snapshot files must not be changed while they are open.
+ *
+ * Of \a options only flags which apply to a parsed model are used,
+ * such as CollectStatistics.
+ *
+ * Returns a new model the caller takes ownership of, or NULL if the
+ * file is not a snapshot this version could read.
+ */
+QLibXmlNodeModel *QLibXmlNodeModel::openSnapshot(const QXmlNamePool &namePool, const QString &fileName, const ParseOptions &options)
+{
+    QLibXmlNodeModel *model = new QLibXmlNodeModel(namePool, options);
+    if (!model->d->loadSnapshot(fileName)) {
+        delete model;
+        return NULL;
+    }
+    return model;
+}
+
+/*!
+ * Returns the element with the given \a id attribute, or a null index
+ * if there is no such element. If many elements have the same id, the
+ * first one in document order is returned.
+ *
+ * Elements are looked up in tables built on the first lookup, so
+ * following lookups do not scan the document.
+ */
+QXmlNodeModelIndex QLibXmlNodeModel::elementById(const QString &id) const
+{
+    QMutexLocker locker(&d->lookupMutex);
+    d->buildLookup();
+    return d->lookup.ids.value(id);
+}
+
+/*!
+ * Returns elements named \a tagName in document order. Tag names of
+ * HTML documents are lower case.
+ */
+QVector<QXmlNodeModelIndex> QLibXmlNodeModel::elementsByTagName(const QString &tagName) const
+{
+    QMutexLocker locker(&d->lookupMutex);
+    d->buildLookup();
+    return d->lookup.tags.value(QXmlName(namePool(), tagName));
+}
+
+/*!
+ * Returns elements which have \a className among the classes listed in
+ * their \c class attribute, in document order.
+ */
+QVector<QXmlNodeModelIndex> QLibXmlNodeModel::elementsByClassName(const QString &className) const
+{
+    QMutexLocker locker(&d->lookupMutex);
+    d->buildLookup();
+    return d->lookup.classes.value(className);
+}
+
+/*!
+ * Returns statistics of the model. Parse time, node count and value
+ * cache hits are always recorded, accessor calls are only counted if
+ * the model was created with the CollectStatistics flag.
+ */
+QLibXmlNodeModel::Statistics QLibXmlNodeModel::statistics() const
+{
+    Statistics stats;
+    stats.parseNsecs = d->parseNsecs;
+    stats.nodeCount = d->nodeCount;
+    if (d->counters) {
+        for (int axis = 0; axis < 4; ++axis) {
+            stats.axisCalls[axis] = d->counters[QLibXmlNodeModelPrivate::ParentCalls + axis].load();
+        }
+        stats.compareOrderCalls = d->counters[QLibXmlNodeModelPrivate::CompareOrderCalls].load();
+        stats.nameCalls = d->counters[QLibXmlNodeModelPrivate::NameCalls].load();
+        stats.kindCalls = d->counters[QLibXmlNodeModelPrivate::KindCalls].load();
+        stats.attributesCalls = d->counters[QLibXmlNodeModelPrivate::AttributesCalls].load();
+        stats.stringValueCalls = d->counters[QLibXmlNodeModelPrivate::StringValueCalls].load();
+        stats.typedValueCalls = d->counters[QLibXmlNodeModelPrivate::TypedValueCalls].load();
+        stats.stringChars = d->counters[QLibXmlNodeModelPrivate::StringChars].load();
+    }
+
+    QMutexLocker locker(&d->cacheMutex);
+    stats.valueCacheHits = d->cacheHits;
+    stats.valueCacheMisses = d->cacheMisses;
+    return stats;
+}
+
+/*!
+ * Sets all accessor call and value cache counters to zero.
+ */
+void QLibXmlNodeModel::resetStatistics()
+{
+    if (d->counters) {
+        for (int i = 0; i < QLibXmlNodeModelPrivate::CounterCount; ++i) {
+            d->counters[i].load(true);
+        }
+    }
+
+    QMutexLocker locker(&d->cacheMutex);
+    d->cacheHits = 0;
+    d->cacheMisses = 0;
+}
+
+/*!
+ * Returns the capacity of the value cache in characters. It is 0,
+ * which disables the cache, unless set by setValueCacheCapacity().
+ */
+int QLibXmlNodeModel::valueCacheCapacity() const
+{
+    return d->cacheCapacity;
+}
+
+/*!
+ * Sets the capacity of the value cache to \a capacity characters.
+ * String values of nodes are kept in the cache, so values read many
+ * times by a query are decoded once. Values used least recently are
+ * dropped when the cache is full. A capacity of 0 disables the cache.
+ *
+ * Must not be called while the model is being queried.
+ */
+void QLibXmlNodeModel::setValueCacheCapacity(int capacity)
+{
+    QMutexLocker locker(&d->cacheMutex);
+    d->cacheCapacity = qMax(0, capacity);
+    d->valueCache.setMaxCost(d->cacheCapacity);
+}
+
+/*!
+ * Evaluates the XPath 1.0 \a expression against the document and
+ * appends the resulting nodes and atomic values to \a result. The
+ * document is the context node and is bound to the \c $dom variable.
+ *
+ * The expression is evaluated by libxml directly on the parsed tree.
+ * Expressions libxml could not evaluate, such as XPath 2.0 ones, are
+ * evaluated by QXmlQuery instead, as are all expressions on a frozen
+ * model. Returns false if the expression is
+ * not valid or could not be evaluated.
+ */
+bool QLibXmlNodeModel::evaluateXPath(const QString &expression, QList<QXmlItem> *result) const
+{
+    Q_ASSERT(result);
+
+    xmlXPathObjectPtr object = d->evaluateXPath(expression);
+    if (object == NULL) {
+        QXmlResultItems items;
+        if (!d->evaluateQuery(expression, &items)) {
+            return false;
+        }
+        for (QXmlItem item = items.next(); !item.isNull(); item = items.next()) {
+            result->append(item);
+        }
+        return !items.hasError();
+    }
+
+    switch (object->type) {
+        case XPATH_NODESET:
+            if (object->nodesetval) {
+                for (int i = 0; i < object->nodesetval->nodeNr; ++i) {
+                    xmlNode *node = object->nodesetval->nodeTab[i];
+                    // Namespace nodes are not part of the model
+                    if (node->type != XML_NAMESPACE_DECL) {
+                        result->append(QXmlItem(d->toNodeIndex(node)));
+                    }
+                }
+            }
+            break;
+        case XPATH_BOOLEAN:
+            result->append(QXmlItem(QVariant(bool(object->boolval))));
+            break;
+        case XPATH_NUMBER:
+            result->append(QXmlItem(QVariant(object->floatval)));
+            break;
+        case XPATH_STRING:
+            result->append(QXmlItem(QVariant(qLibXmlFromUtf8((const char *)object->stringval))));
+            break;
+        default:
+            break;
+    }
+
+    xmlXPathFreeObject(object);
+    return true;
+}
+
+/*!
+ * \overload
+ *
+ * Appends string values of the resulting items to \a result, which
+ * saves creating items for nodes.
+ */
+bool QLibXmlNodeModel::evaluateXPath(const QString &expression, QStringList *result) const
+{
+    Q_ASSERT(result);
+
+    xmlXPathObjectPtr object = d->evaluateXPath(expression);
+    if (object == NULL) {
+        QXmlResultItems items;
+        if (!d->evaluateQuery(expression, &items)) {
+            return false;
+        }
+        for (QXmlItem item = items.next(); !item.isNull(); item = items.next()) {
+            if (item.isNode()) {
+                QXmlNodeModelIndex index = item.toNodeModelIndex();
+                result->append(index.model()->stringValue(index));
+            } else {
+                result->append(item.toAtomicValue().toString());
+            }
+        }
+        return !items.hasError();
+    }
+
+    if (object->type == XPATH_NODESET) {
+        if (object->nodesetval) {
+            for (int i = 0; i < object->nodesetval->nodeNr; ++i) {
+                xmlNode *node = object->nodesetval->nodeTab[i];
+                if (node->type != XML_NAMESPACE_DECL) {
+                    result->append(stringValue(d->toNodeIndex(node)));
+                }
+            }
+        }
+    } else {
+        // Numbers are formatted the XPath way
+        xmlChar *str = xmlXPathCastToString(object);
+        result->append(qLibXmlFromUtf8((const char *)str));
+        xmlFree(str);
+    }
+
+    xmlXPathFreeObject(object);
+    return true;
+}
+
+/*!
+ * Writes \a node with its subtree as markup to \a device. Nodes are
+ * written by libxml directly from the parsed tree, HTML documents the
+ * HTML way, so this is much faster than QXmlSerializer.
+ *
+ * Returns false if the node does not belong to this model, the model
+ * is frozen, or writing to the device failed.
+ */
+bool QLibXmlNodeModel::serialize(const QXmlNodeModelIndex &node, QIODevice *device) const
+{
+    Q_ASSERT(device);
+
+    if (node.model() != this || d->doc == NULL) {
+        return false;
+    }
+    return d->serialize(d->toNode(node), device);
+}
+
+/*!
+ * Parses next \a size bytes of the source from \a data. The data is
+ * not needed anymore after the call returns. Returns false if the
+ * model is not waiting for a source, see createIncremental().
+ */
+bool QLibXmlNodeModel::feed(const char *data, int size)
+{
+    return d->pushChunk(data, size, false);
+}
+
+/*!
+ * \overload
+ */
+bool QLibXmlNodeModel::feed(const QByteArray &chunk)
+{
+    return d->pushChunk(chunk.constData(), chunk.size(), false);
+}
+
+/*!
+ * Finishes parsing of a source given by feed(). Returns true if the
+ * document was parsed.
+ */
+bool QLibXmlNodeModel::finish()
+{
+    return d->pushChunk(NULL, 0, true);
+}
+
 /*!
  * This function is called by the QtXmlPatterns query engine when it
  * wants to move to the next node in the model. It moves along an \a
@@ -128,6 +1953,30 @@ QLibXmlNodeModel::~QLibXmlNodeModel()
 QXmlNodeModelIndex
 QLibXmlNodeModel::nextFromSimpleAxis(SimpleAxis axis, const QXmlNodeModelIndex &nodeIndex) const
 {
+    d->count(QLibXmlNodeModelPrivate::Counter(QLibXmlNodeModelPrivate::ParentCalls + axis));
+
+    if (d->isFrozen()) {
+        quint32 pos = d->toPosition(nodeIndex);
+        quint32 next = 0;
+        switch (axis) {
+            case Parent:
+                if (pos == 0) {
+                    return QXmlNodeModelIndex();
+                }
+                return d->toFrozenIndex(d->tree.parents[pos]);
+            case FirstChild:
+                next = d->tree.firstChildren[pos];
+                break;
+            case PreviousSibling:
+                next = d->tree.previousSiblings[pos];
+                break;
+            case NextSibling:
+                next = d->tree.nextSiblings[pos];
+                break;
+        }
+        return next ? d->toFrozenIndex(next) : QXmlNodeModelIndex();
+    }
+
     xmlNode *node = d->toNode(nodeIndex);
     //qDebug() << "nextFromSimpleAxis()" << node << axis;
     if (!node) {
@@ -191,6 +2040,12 @@ QUrl QLibXmlNodeModel::documentUri(const QXmlNodeModelIndex &node) const
 QXmlNodeModelIndex::NodeKind
 QLibXmlNodeModel::kind(const QXmlNodeModelIndex &nodeIndex) const
 {
+    d->count(QLibXmlNodeModelPrivate::KindCalls);
+
+    if (d->isFrozen()) {
+        return d->tree.kind(d->toPosition(nodeIndex));
+    }
+
     xmlNode *node = d->toNode(nodeIndex);
     //qDebug() << "kind()" << node;
     if (!node) {
@@ -233,83 +2088,38 @@ QLibXmlNodeModel::kind(const QXmlNodeModelIndex &nodeIndex) const
  */
 QXmlNodeModelIndex::DocumentOrder QLibXmlNodeModel::compareOrder(const QXmlNodeModelIndex &nodeIndex1, const QXmlNodeModelIndex &nodeIndex2) const
 {
-    xmlNode *node1 = d->toNode(nodeIndex1);
-    xmlNode *node2 = d->toNode(nodeIndex2);
-    if (!node1) {
-        //qDebug() << "Invalid node";
-        return QXmlNodeModelIndex::Precedes;
-    }
-    if (!node2) {
-        //qDebug() << "Invalid node";
-        return QXmlNodeModelIndex::Follows;
-    }
-
-    xmlNode *cur;
-
-    //qDebug() << "compareOrder()" << node1 << node2;
-
-    // Check is nodes are root
-    if (node1->parent == NULL) {
-        return QXmlNodeModelIndex::Precedes;
-    }
-    if (node2->parent == NULL) {
-        return QXmlNodeModelIndex::Follows;
-    }
-
-    // Find nodes which has common parent
-    if (node1->parent != node2->parent) {
-        QList<xmlNode*> tree1;
-        QList<xmlNode*> tree2;
-
-        // Build trees for node1 and node2
-        for (cur = node1->parent; cur != NULL; cur = cur->parent) {
-            tree1.push_front(cur);
-        }
-        for (cur = node2->parent; cur != NULL; cur = cur->parent) {
-            tree2.push_front(cur);
-        }
-
-        // Find last common element in lists (common parent of nodes)
-        QList<xmlNode*>::const_iterator iter1;
-        QList<xmlNode*>::const_iterator iter2;
-        node1 = node2 = NULL;
-        for (iter1 = tree1.begin(), iter2 = tree2.begin(); iter1 != tree1.end() && iter2 != tree2.end(); ++iter1, ++iter2) {
-            if (*iter1 != *iter2) {
-                break;
-            }
-        }
+    d->count(QLibXmlNodeModelPrivate::CompareOrderCalls);
 
-        // One node is successor of another
-        if (iter1 == tree1.end()) {
+    qptrdiff ordinal1;
+    qptrdiff ordinal2;
+    if (d->isFrozen()) {
+        ordinal1 = d->toPosition(nodeIndex1);
+        ordinal2 = d->toPosition(nodeIndex2);
+    } else {
+        xmlNode *node1 = d->toNode(nodeIndex1);
+        xmlNode *node2 = d->toNode(nodeIndex2);
+        if (!node1) {
+            //qDebug() << "Invalid node";
             return QXmlNodeModelIndex::Precedes;
         }
-        if (iter2 == tree2.end()) {
+        if (!node2) {
+            //qDebug() << "Invalid node";
             return QXmlNodeModelIndex::Follows;
         }
 
-        // Asign nodes from nodes' tree which are children of common parent
-        node1 = *iter1;
-        node2 = *iter2;
+        //qDebug() << "compareOrder()" << node1 << node2;
 
-        //qDebug() << tree1 << tree2 << node1 << node2;
-        Q_ASSERT_X(node1 && node2, Q_FUNC_INFO, "Nodes has no common parent");
+        ordinal1 = QLibXmlNodeModelPrivate::ordinal(node1);
+        ordinal2 = QLibXmlNodeModelPrivate::ordinal(node2);
     }
 
-    Q_ASSERT_X(node1 != node2, Q_FUNC_INFO, "Different nodes' parent is equal");
-    Q_ASSERT_X(node1->parent == node2->parent, Q_FUNC_INFO, "Common parent is found improperly");
-    Q_ASSERT_X(node1->parent->children, Q_FUNC_INFO, "Node parent has no children");
-
-    // Find which node precedes
-    for (cur = node1->parent->children; cur != NULL; cur = cur->next) {
-        if (cur == node1) {
-            return QXmlNodeModelIndex::Precedes;
-        } else if (cur == node2) {
-            return QXmlNodeModelIndex::Follows;
-        }
+    if (ordinal1 < ordinal2) {
+        return QXmlNodeModelIndex::Precedes;
     }
-
-    Q_ASSERT_X(false, Q_FUNC_INFO, "Should not get here");
-    return QXmlNodeModelIndex::Precedes;
+    if (ordinal1 > ordinal2) {
+        return QXmlNodeModelIndex::Follows;
+    }
+    return QXmlNodeModelIndex::Is;
 }
 
 /*!
@@ -318,6 +2128,12 @@ QXmlNodeModelIndex::DocumentOrder QLibXmlNodeModel::compareOrder(const QXmlNodeM
  */
 QXmlName QLibXmlNodeModel::name(const QXmlNodeModelIndex &nodeIndex) const
 {
+    d->count(QLibXmlNodeModelPrivate::NameCalls);
+
+    if (d->isFrozen()) {
+        return d->tree.nameTable.at(d->tree.names[d->toPosition(nodeIndex)]);
+    }
+
     xmlNode *node = d->toNode(nodeIndex);
     //qDebug() << "name()" << node;
     if (!node) {
@@ -326,7 +2142,21 @@ QXmlName QLibXmlNodeModel::name(const QXmlNodeModelIndex &nodeIndex) const
     }
 
     //qDebug() << "Node name" << (const char *)node->name;
-    return QXmlName(namePool(), QString::fromUtf8((const char *)node->name));
+    QHash<const xmlChar *, QXmlName>::const_iterator cached = d->names.constFind(node->name);
+    if (cached != d->names.constEnd()) {
+        return cached.value();
+    }
+
+    return QXmlName(namePool(), qLibXmlFromUtf8((const char *)node->name));
+}
+
+/*!
+ * Returns the element whose \c id attribute matches the local name of
+ * \a id. This is used by the \c fn:id() function.
+ */
+QXmlNodeModelIndex QLibXmlNodeModel::elementById(const QXmlName &id) const
+{
+    return elementById(id.localName(namePool()));
 }
 
 /*!
@@ -350,16 +2180,13 @@ QXmlNodeModelIndex QLibXmlNodeModel::root(const QXmlNodeModelIndex &nodeIndex) c
  */
 QVariant QLibXmlNodeModel::typedValue(const QXmlNodeModelIndex &nodeIndex) const
 {
-    xmlNode *node = d->toNode(nodeIndex);
-    //qDebug() << "typedValue()" << node;
-    Q_ASSERT_X(node, Q_FUNC_INFO, "Invalid node");
+    d->count(QLibXmlNodeModelPrivate::TypedValueCalls);
 
-    xmlChar *buf = xmlNodeGetContent(node);
-    QString str = QString::fromUtf8((const char *)buf);
-    xmlFree(buf);
+    //qDebug() << "typedValue()" << nodeIndex.data();
+    Q_ASSERT_X(d->isFrozen() || d->toNode(nodeIndex), Q_FUNC_INFO, "Invalid node");
 
-    //qDebug() << "Attribute typed value" << str;
-    return str;
+    // Nodes are untyped, the typed value is the string value
+    return d->counted(d->cachedValue(nodeIndex));
 }
 
 /*!
@@ -368,6 +2195,17 @@ QVariant QLibXmlNodeModel::typedValue(const QXmlNodeModelIndex &nodeIndex) const
  */
 QVector<QXmlNodeModelIndex> QLibXmlNodeModel::attributes(const QXmlNodeModelIndex &nodeIndex) const
 {
+    d->count(QLibXmlNodeModelPrivate::AttributesCalls);
+
+    if (d->isFrozen()) {
+        // Attributes follow their owner element
+        QVector<QXmlNodeModelIndex> result;
+        for (quint32 pos = d->toPosition(nodeIndex) + 1; pos < d->tree.nodeCount && d->tree.kind(pos) == QXmlNodeModelIndex::Attribute; ++pos) {
+            result += d->toFrozenIndex(pos);
+        }
+        return result;
+    }
+
     xmlNode *node = d->toNode(nodeIndex);
     //qDebug() << "attributes()" << node;
     Q_ASSERT_X(node, Q_FUNC_INFO, "Invalid node");
@@ -404,26 +2242,8 @@ QVector<QXmlNodeModelIndex> QLibXmlNodeModel::attributes(const QXmlNodeModelInde
  */
 QString QLibXmlNodeModel::stringValue (const QXmlNodeModelIndex &nodeIndex) const
 {
-    xmlNode *node = d->toNode(nodeIndex);
-    //qDebug() << "stringValue()" << node;
-
-    if (node->type == XML_TEXT_NODE ||
-        node->type == XML_CDATA_SECTION_NODE ||
-        node->type == XML_COMMENT_NODE) {
-        xmlChar *buf = xmlNodeGetContent(node);
-        QString str = QString::fromUtf8((const char *)buf);
-        xmlFree(buf);
-
-        return str;
-    }
-
-    if (node->type == XML_ELEMENT_NODE ||
-        node->type == XML_ATTRIBUTE_NODE) {
-        return QSimpleXmlNodeModel::stringValue(nodeIndex);
-    }
-
-    // TODO: handle other node types
-    //qDebug() << "Node type is not handled properly in stringValue()" << node->type;
+    d->count(QLibXmlNodeModelPrivate::StringValueCalls);
 
-    return QString();
+    //qDebug() << "stringValue()" << nodeIndex.data();
+    return d->counted(d->cachedValue(nodeIndex));
 }
@@ -30,19 +30,124 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef QLIBXMLNODEMODEL_H
+#define QLIBXMLNODEMODEL_H
+
 #include <QSimpleXmlNodeModel>
+#include <QStringList>
 #include <QVector>
+#include <QXmlItem>
+
+#include "qlibxmldictionary.h"
+
+struct _xmlDoc;
 
+class QIODevice;
 class QLibXmlNodeModelPrivate;
 
 class QLibXmlNodeModel : public QSimpleXmlNodeModel
 {
     friend class QLibXmlNodeModelPrivate;
+    friend class QLibXmlCollectionModelPrivate;
+    friend class QLibXmlStreamExtractorPrivate;
 
 public:
-    QLibXmlNodeModel(const QXmlNamePool&, const QByteArray&, const QUrl&);
+    enum ParserMode {
+        HtmlParser,
+        XmlParser
+    };
+
+    enum ParseFlag {
+        NoParseFlags = 0x0,
+        CompactText = 0x1,
+        StripBlankText = 0x2,
+        SuppressErrors = 0x4,
+        NoNetwork = 0x8,
+        Freeze = 0x10,
+        CollectStatistics = 0x20,
+        ArenaAllocation = 0x40
+    };
+    Q_DECLARE_FLAGS(ParseFlags, ParseFlag)
+
+    // Describes how the source is parsed, an empty encoding means that
+    // it is detected from the source. Strings are interned in the shared
+    // dictionary if one is given, which must belong to the name pool of
+    // the model.
+    struct ParseOptions
+    {
+        ParseOptions() : mode(HtmlParser), flags(NoParseFlags), encoding("utf-8"), dictionary(NULL) {}
+
+        ParserMode mode;
+        ParseFlags flags;
+        QByteArray encoding;
+        const QLibXmlDictionary *dictionary;
+    };
+
+    // Time spent parsing, number of nodes, value cache hits and misses
+    // and, with the CollectStatistics flag, numbers of accessor calls.
+    // Axis calls are indexed by SimpleAxis, string characters are summed
+    // over string and typed values returned.
+    struct Statistics
+    {
+        Statistics()
+            : parseNsecs(0), nodeCount(0), compareOrderCalls(0), nameCalls(0),
+              kindCalls(0), attributesCalls(0), stringValueCalls(0),
+              typedValueCalls(0), stringChars(0), valueCacheHits(0),
+              valueCacheMisses(0)
+        {
+            axisCalls[0] = axisCalls[1] = axisCalls[2] = axisCalls[3] = 0;
+        }
+
+        qint64 parseNsecs;
+        qint64 nodeCount;
+        qint64 axisCalls[4];
+        qint64 compareOrderCalls;
+        qint64 nameCalls;
+        qint64 kindCalls;
+        qint64 attributesCalls;
+        qint64 stringValueCalls;
+        qint64 typedValueCalls;
+        qint64 stringChars;
+        qint64 valueCacheHits;
+        qint64 valueCacheMisses;
+    };
+
+    QLibXmlNodeModel(const QXmlNamePool&, const QByteArray&, const QUrl&, const ParseOptions& = ParseOptions());
+    QLibXmlNodeModel(const QXmlNamePool&, QIODevice*, const QUrl&, const ParseOptions& = ParseOptions());
+    QLibXmlNodeModel(const QXmlNamePool&, const QString&, const ParseOptions& = ParseOptions());
     ~QLibXmlNodeModel();
 
+    static QLibXmlNodeModel *createIncremental(const QXmlNamePool&, const QUrl&, const ParseOptions& = ParseOptions());
+
+    bool reset(const QByteArray&, const QUrl&);
+
+    QStringList parseErrors() const;
+
+    void freeze();
+    bool isFrozen() const;
+
+    bool saveSnapshot(QIODevice*) const;
+    static QLibXmlNodeModel *openSnapshot(const QXmlNamePool&, const QString&, const ParseOptions& = ParseOptions());
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+    int valueCacheCapacity() const;
+    void setValueCacheCapacity(int);
+
+    QXmlNodeModelIndex elementById(const QString&) const;
+    QVector<QXmlNodeModelIndex> elementsByTagName(const QString&) const;
+    QVector<QXmlNodeModelIndex> elementsByClassName(const QString&) const;
+
+    bool evaluateXPath(const QString&, QList<QXmlItem>*) const;
+    bool evaluateXPath(const QString&, QStringList*) const;
+
+    bool serialize(const QXmlNodeModelIndex&, QIODevice*) const;
+
+    bool feed(const char*, int);
+    bool feed(const QByteArray&);
+    bool finish();
+
     inline QXmlNodeModelIndex dom() const { return root(QXmlNodeModelIndex()); }
 
     virtual QXmlNodeModelIndex::DocumentOrder compareOrder(const QXmlNodeModelIndex&, const QXmlNodeModelIndex&) const;
@@ -52,12 +157,20 @@ public:
     virtual QXmlNodeModelIndex root(const QXmlNodeModelIndex&) const;
     virtual QVariant typedValue(const QXmlNodeModelIndex&) const;
     virtual QString stringValue (const QXmlNodeModelIndex&) const;
+    virtual QXmlNodeModelIndex elementById(const QXmlName&) const;
 
 protected:
     virtual QVector<QXmlNodeModelIndex> attributes(const QXmlNodeModelIndex&) const;
     virtual QXmlNodeModelIndex nextFromSimpleAxis(SimpleAxis, const QXmlNodeModelIndex&) const;
 
 private:
+    QLibXmlNodeModel(const QXmlNamePool&, const ParseOptions&);
+    QLibXmlNodeModel(const QXmlNamePool&, _xmlDoc*, const QUrl&, const ParseOptions&);
+
     QLibXmlNodeModelPrivate *d;
 };
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(QLibXmlNodeModel::ParseFlags)
+
+#endif // QLIBXMLNODEMODEL_H
+
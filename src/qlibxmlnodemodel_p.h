@@ -0,0 +1,61 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QLIBXMLNODEMODEL_P_H
+#define QLIBXMLNODEMODEL_P_H
+
+#include <QStringList>
+#include <QUrl>
+
+#include <libxml/parser.h>
+
+#include "qlibxmlnodemodel.h"
+
+// Size of chunks the source is read from a device by
+static const int ChunkSize = 16384;
+
+// Number of parse errors kept per document
+static const int MaxParseErrors = 100;
+
+// Returns libxml parser options for the parse options
+int qLibXmlParserOptions(const QLibXmlNodeModel::ParseOptions &options);
+
+// Applies the parse options to a push parser context, forcing the
+// encoding if one is given
+void qLibXmlUseOptions(xmlParserCtxtPtr ctxt, const QLibXmlNodeModel::ParseOptions &options);
+
+// Adds an error reported by the parser for the document at uri to
+// errors, up to MaxParseErrors of them. Errors are also printed unless
+// the options suppress them.
+void qLibXmlAddError(QStringList *errors, const QUrl &uri, const QLibXmlNodeModel::ParseOptions &options, xmlErrorPtr error);
+
+#endif // QLIBXMLNODEMODEL_P_H
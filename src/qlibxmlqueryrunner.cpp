@@ -0,0 +1,223 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QCache>
+#include <QRegExp>
+#include <QXmlFormatter>
+#include <QXmlNamePool>
+#include <QXmlQuery>
+#include <QXmlResultItems>
+
+#include "qlibxmlqueryrunner.h"
+
+// Number of compiled queries kept by default
+static const int DefaultCapacity = 1024;
+
+// Compiled query and the document its $dom variable is bound to
+struct QLibXmlCompiledQuery
+{
+    explicit QLibXmlCompiledQuery(const QXmlNamePool &namePool)
+        : query(namePool), bindsDom(false)
+    {
+    }
+
+    QXmlQuery query;
+    QXmlNodeModelIndex dom;
+    bool bindsDom;
+};
+
+// Internal private data
+class QLibXmlQueryRunnerPrivate
+{
+public:
+    QXmlNamePool namePool;
+    QUrl baseUri;
+
+    // Compiled queries keyed on their text
+    QCache<QString, QLibXmlCompiledQuery> queries;
+
+    QLibXmlQueryRunnerPrivate(const QXmlNamePool &namePool, const QUrl &baseUri)
+        : namePool(namePool), baseUri(baseUri), queries(DefaultCapacity)
+    {
+    }
+
+    // Returns true if the query could refer to the $dom variable
+    static bool refersToDom(const QString &text)
+    {
+        return text.contains(QRegExp("\\$\\s*dom\\b"));
+    }
+
+    // Returns the compiled query for the text with the document of the
+    // model used as focus and bound to $dom, or NULL if the query is not
+    // valid. The focus is only read when the query is evaluated, but
+    // QXmlQuery::bindVariable() compiles the query again whenever a node
+    // replaces a node binding, so $dom is only bound for queries
+    // referring to it.
+    QXmlQuery *query(const QString &text, const QLibXmlNodeModel &model)
+    {
+        QXmlNodeModelIndex dom = model.dom();
+
+        QLibXmlCompiledQuery *compiled = queries.object(text);
+        if (compiled == NULL) {
+            // The focus and variables have to be set before compiling
+            compiled = new QLibXmlCompiledQuery(namePool);
+            compiled->bindsDom = refersToDom(text);
+            if (compiled->bindsDom) {
+                compiled->query.bindVariable("dom", dom);
+                compiled->dom = dom;
+            }
+            compiled->query.setFocus(dom);
+            compiled->query.setQuery(text, baseUri);
+            queries.insert(text, compiled);
+        } else {
+            if (compiled->bindsDom && compiled->dom != dom) {
+                compiled->query.bindVariable("dom", dom);
+                compiled->dom = dom;
+            }
+            compiled->query.setFocus(dom);
+        }
+
+        return compiled->query.isValid() ? &compiled->query : NULL;
+    }
+};
+
+/*!
+ * Constructs a runner compiling queries with \a namePool. Models passed
+ * to evaluate() must be created with the same name pool. Relative URIs
+ * in queries are resolved against \a baseUri.
+ *
+ * A runner must only be used by one thread at a time. Threads could use
+ * runners of their own sharing the same name pool.
+ */
+QLibXmlQueryRunner::QLibXmlQueryRunner(const QXmlNamePool &namePool, const QUrl &baseUri)
+    : d(new QLibXmlQueryRunnerPrivate(namePool, baseUri))
+{
+}
+
+/*!
+ * Destructor
+ */
+QLibXmlQueryRunner::~QLibXmlQueryRunner()
+{
+    delete d;
+}
+
+/*!
+ * Returns the name pool queries are compiled with.
+ */
+QXmlNamePool QLibXmlQueryRunner::namePool() const
+{
+    return d->namePool;
+}
+
+/*!
+ * Returns the number of compiled queries the runner keeps. The default
+ * is 1024.
+ */
+int QLibXmlQueryRunner::capacity() const
+{
+    return d->queries.maxCost();
+}
+
+/*!
+ * Sets the number of compiled queries the runner keeps to \a capacity.
+ * Queries used least recently are dropped first.
+ */
+void QLibXmlQueryRunner::setCapacity(int capacity)
+{
+    d->queries.setMaxCost(capacity);
+}
+
+/*!
+ * Drops all compiled queries.
+ */
+void QLibXmlQueryRunner::clear()
+{
+    d->queries.clear();
+}
+
+/*!
+ * Evaluates \a query against the document of \a model, which is used as
+ * the focus, so paths such as \c{//a/@href} start at the document. The
+ * document is also bound to \c{$dom}, the way htmlquery binds it. The
+ * query is compiled on first use only, unless it refers to \c{$dom},
+ * as QXmlQuery compiles a query again when a variable is bound to
+ * another node. Results are returned in \a result, which must not
+ * be used after another query is evaluated by the runner. Returns false
+ * if the query is not valid.
+ */
+bool QLibXmlQueryRunner::evaluate(const QString &query, const QLibXmlNodeModel &model, QXmlResultItems *result)
+{
+    QXmlQuery *xmlQuery = d->query(query, model);
+    if (xmlQuery == NULL) {
+        return false;
+    }
+
+    xmlQuery->evaluateTo(result);
+    return !result->hasError();
+}
+
+/*!
+ * \overload
+ *
+ * Appends results to \a result, they must be strings.
+ */
+bool QLibXmlQueryRunner::evaluate(const QString &query, const QLibXmlNodeModel &model, QStringList *result)
+{
+    QXmlQuery *xmlQuery = d->query(query, model);
+    if (xmlQuery == NULL) {
+        return false;
+    }
+
+    QStringList strings;
+    if (!xmlQuery->evaluateTo(&strings)) {
+        return false;
+    }
+    result->append(strings);
+    return true;
+}
+
+/*!
+ * \overload
+ *
+ * Writes results formatted as XML to \a device.
+ */
+bool QLibXmlQueryRunner::evaluate(const QString &query, const QLibXmlNodeModel &model, QIODevice *device)
+{
+    QXmlQuery *xmlQuery = d->query(query, model);
+    if (xmlQuery == NULL) {
+        return false;
+    }
+
+    QXmlFormatter formatter(*xmlQuery, device);
+    return xmlQuery->evaluateTo(&formatter);
+}
@@ -0,0 +1,171 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QIODevice>
+#include <QScopedPointer>
+#include <QXmlNamePool>
+#include <QXmlQuery>
+#include <QXmlResultItems>
+#include <QXmlSerializer>
+
+#include "qlibxmlnodemodel.h"
+#include "qlibxmlserializer.h"
+
+// Internal private data
+class QLibXmlSerializerPrivate
+{
+public:
+    QXmlNamePool namePool;
+    QIODevice *device;
+
+    // Whether the last item written was an atomic value, adjacent
+    // values are separated by a space
+    bool atomic;
+
+    // Query writing other nodes through QXmlSerializer, created on the
+    // first such node
+    QScopedPointer<QXmlQuery> query;
+
+    QLibXmlSerializerPrivate(const QXmlNamePool &namePool, QIODevice *device)
+        : namePool(namePool), device(device), atomic(false)
+    {
+    }
+
+    // Writes text with markup characters escaped
+    bool writeText(const QString &text)
+    {
+        QByteArray data = text.toUtf8();
+        data.replace('&', "&amp;");
+        data.replace('<', "&lt;");
+        data.replace('>', "&gt;");
+        return device->write(data) == data.size();
+    }
+
+    // Writes an atomic value as its string value
+    bool writeAtomicValue(const QVariant &value)
+    {
+        if (atomic && device->write(" ", 1) != 1) {
+            return false;
+        }
+        atomic = true;
+        return writeText(value.toString());
+    }
+
+    // Writes a node of a libxml model directly, and other nodes, such
+    // as constructed or frozen ones, by evaluating a query returning
+    // its focus. Only the focus changes from node to node, rebinding a
+    // node variable would compile the query again each time.
+    bool writeNode(const QXmlNodeModelIndex &node)
+    {
+        atomic = false;
+
+        const QLibXmlNodeModel *model = dynamic_cast<const QLibXmlNodeModel *>(node.model());
+        if (model && !model->isFrozen()) {
+            return model->serialize(node, device);
+        }
+
+        if (query.isNull()) {
+            query.reset(new QXmlQuery(namePool));
+            query->setFocus(QXmlItem(node));
+            query->setQuery(".");
+        } else {
+            query->setFocus(QXmlItem(node));
+        }
+
+        QXmlSerializer serializer(*query, device);
+        return query->evaluateTo(&serializer);
+    }
+};
+
+/*!
+ * Constructs a serializer writing to \a device, which must be open for
+ * writing. Nodes which do not belong to a QLibXmlNodeModel are written
+ * by QXmlSerializer using \a namePool, which must be the name pool of
+ * the query the items come from.
+ */
+QLibXmlSerializer::QLibXmlSerializer(const QXmlNamePool &namePool, QIODevice *device)
+    : d(new QLibXmlSerializerPrivate(namePool, device))
+{
+    Q_ASSERT(device);
+}
+
+/*!
+ * Destructor
+ */
+QLibXmlSerializer::~QLibXmlSerializer()
+{
+    delete d;
+}
+
+/*!
+ * Returns the device the serializer writes to.
+ */
+QIODevice *QLibXmlSerializer::outputDevice() const
+{
+    return d->device;
+}
+
+/*!
+ * Writes \a item to the device. Nodes of a QLibXmlNodeModel are written
+ * with their subtrees by libxml, see QLibXmlNodeModel::serialize().
+ * Atomic values are written as their string values with markup
+ * characters escaped, adjacent values separated by a space.
+ *
+ * Returns false if the item could not be written.
+ */
+bool QLibXmlSerializer::write(const QXmlItem &item)
+{
+    if (item.isNode()) {
+        return d->writeNode(item.toNodeModelIndex());
+    } else if (item.isAtomicValue()) {
+        return d->writeAtomicValue(item.toAtomicValue());
+    }
+    return true;
+}
+
+/*!
+ * \overload
+ *
+ * Writes all remaining items of \a items. Returns false if an item could
+ * not be written or evaluating the items failed.
+ */
+bool QLibXmlSerializer::write(QXmlResultItems *items)
+{
+    Q_ASSERT(items);
+
+    for (QXmlItem item = items->next(); !item.isNull(); item = items->next()) {
+        if (!write(item)) {
+            return false;
+        }
+    }
+    return !items->hasError();
+}
@@ -0,0 +1,241 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtGlobal>
+#if QT_VERSION >= 0x050100
+#include <QSaveFile>
+#elif defined(Q_OS_WIN)
+#include <windows.h>
+#else
+#include <stdio.h>
+#endif
+
+#include <QCryptographicHash>
+#include <QDebug>
+#include <QDir>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryFile>
+
+#include "qlibxmlsnapshotcache.h"
+
+// Suffix of snapshot files in the cache directory
+static const char SnapshotSuffix[] = ".qlxs";
+
+#if QT_VERSION < 0x050100
+// Renames a file over another one in a single step, QFile::rename()
+// does not replace existing files
+static bool replaceFile(const QString &from, const QString &to)
+{
+#if defined(Q_OS_WIN)
+    return MoveFileExW((const wchar_t *)QDir::toNativeSeparators(from).utf16(),
+                       (const wchar_t *)QDir::toNativeSeparators(to).utf16(),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0;
+#endif
+}
+#endif
+
+// Internal private data
+class QLibXmlSnapshotCachePrivate
+{
+public:
+    QString directory;
+
+    QLibXmlSnapshotCachePrivate(const QString &directory)
+        : directory(directory)
+    {
+    }
+
+    // Writes a snapshot of the model to a temporary file which then
+    // replaces the snapshot at once, so readers see either the old or
+    // the new snapshot, never a partially written one or none. Of
+    // concurrent storers, the last one wins.
+    void store(const QLibXmlNodeModel *model, const QString &path)
+    {
+#if QT_VERSION >= 0x050100
+        QSaveFile file(path);
+        if (!file.open(QIODevice::WriteOnly) || !model->saveSnapshot(&file) || !file.commit()) {
+            qDebug() << "could not write snapshot" << path;
+        }
+#else
+        QTemporaryFile file(directory + "/XXXXXX.tmp");
+        if (!file.open() || !model->saveSnapshot(&file)) {
+            qDebug() << "could not write snapshot" << file.fileName();
+            return;
+        }
+        file.close();
+
+        if (replaceFile(file.fileName(), path)) {
+            file.setAutoRemove(false);
+        }
+#endif
+    }
+
+    // Opens the snapshot at path if there is one
+    static QLibXmlNodeModel *open(const QXmlNamePool &namePool, const QString &path, const QLibXmlNodeModel::ParseOptions &options)
+    {
+        if (!QFile::exists(path)) {
+            return NULL;
+        }
+        return QLibXmlNodeModel::openSnapshot(namePool, path, options);
+    }
+
+    // Returns the name of the snapshot for a hash of the source and
+    // adds the options which change the parsed document to the hash
+    QString snapshotPath(QCryptographicHash &hash, const QLibXmlNodeModel::ParseOptions &options) const
+    {
+        QLibXmlNodeModel::ParseFlags flags = options.flags & (QLibXmlNodeModel::StripBlankText | QLibXmlNodeModel::NoNetwork);
+        hash.addData(QByteArray::number(options.mode) + ' ' + QByteArray::number((int)flags) + ' ' + options.encoding);
+        return directory + '/' + hash.result().toHex() + SnapshotSuffix;
+    }
+};
+
+/*!
+ * Constructs a cache keeping snapshots of parsed documents in \a directory,
+ * which is created if it does not exist. Caches keep no other state, so
+ * any number of them, in any number of processes, could share a directory.
+ */
+QLibXmlSnapshotCache::QLibXmlSnapshotCache(const QString &directory)
+    : d(new QLibXmlSnapshotCachePrivate(directory))
+{
+    QDir().mkpath(directory);
+}
+
+/*!
+ * Destructor
+ */
+QLibXmlSnapshotCache::~QLibXmlSnapshotCache()
+{
+    delete d;
+}
+
+/*!
+ * Returns the directory of the cache.
+ */
+QString QLibXmlSnapshotCache::directory() const
+{
+    return d->directory;
+}
+
+/*!
+ * Returns the name of the snapshot file for \a source at \a uri parsed
+ * with \a options. The name is a hash of the source, the URI and the
+ * options which change the parsed document, so a changed source never
+ * matches an old snapshot.
+ */
+QString QLibXmlSnapshotCache::fileName(const QByteArray &source, const QUrl &uri, const QLibXmlNodeModel::ParseOptions &options) const
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(source);
+    hash.addData(uri.toEncoded());
+    return d->snapshotPath(hash, options);
+}
+
+/*!
+ * Returns the name of the snapshot file for the file \a sourceFile
+ * parsed with \a options. The name is a hash of the absolute path, the
+ * size and the modification time of the file and of the options, so the
+ * file is not read. A file rewritten with the same size within the
+ * resolution of its modification time matches its old snapshot.
+ */
+QString QLibXmlSnapshotCache::fileName(const QString &sourceFile, const QLibXmlNodeModel::ParseOptions &options) const
+{
+    QFileInfo info(sourceFile);
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(info.absoluteFilePath().toUtf8());
+    hash.addData(' ' + QByteArray::number(info.size()) + ' ' + QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + ' ');
+    return d->snapshotPath(hash, options);
+}
+
+/*!
+ * Returns a model for \a source at \a uri. The model is opened from the
+ * snapshot of the source if there is one, otherwise the source is parsed
+ * with \a options and a snapshot is written for the next time. Models
+ * are frozen either way. Sources which could not be parsed are not
+ * cached. The caller takes ownership of the model.
+ */
+QLibXmlNodeModel *QLibXmlSnapshotCache::model(const QXmlNamePool &namePool, const QByteArray &source, const QUrl &uri, const QLibXmlNodeModel::ParseOptions &options) const
+{
+    QString path = fileName(source, uri, options);
+    QLibXmlNodeModel *model = d->open(namePool, path, options);
+    if (model) {
+        return model;
+    }
+
+    QLibXmlNodeModel::ParseOptions parseOptions = options;
+    parseOptions.flags |= QLibXmlNodeModel::Freeze;
+    model = new QLibXmlNodeModel(namePool, source, uri, parseOptions);
+    if (model->isFrozen()) {
+        d->store(model, path);
+    }
+    return model;
+}
+
+/*!
+ * Returns a model for the file \a sourceFile, the same way as the
+ * model() taking a source does, but keyed as fileName() for a file is.
+ * The file is only read if there is no snapshot of it, and is then
+ * mapped into memory for parsing.
+ */
+QLibXmlNodeModel *QLibXmlSnapshotCache::model(const QXmlNamePool &namePool, const QString &sourceFile, const QLibXmlNodeModel::ParseOptions &options) const
+{
+    QString path = fileName(sourceFile, options);
+    QLibXmlNodeModel *model = d->open(namePool, path, options);
+    if (model) {
+        return model;
+    }
+
+    QLibXmlNodeModel::ParseOptions parseOptions = options;
+    parseOptions.flags |= QLibXmlNodeModel::Freeze;
+    model = new QLibXmlNodeModel(namePool, sourceFile, parseOptions);
+    if (model->isFrozen()) {
+        d->store(model, path);
+    }
+    return model;
+}
+
+/*!
+ * Removes all snapshots from the cache directory. Models opened from
+ * them stay valid, as their files are only unlinked.
+ */
+void QLibXmlSnapshotCache::clear()
+{
+    QDir dir(d->directory);
+    QStringList files = dir.entryList(QStringList() << QString("*") + SnapshotSuffix, QDir::Files);
+    for (int i = 0; i < files.size(); ++i) {
+        dir.remove(files.at(i));
+    }
+}
@@ -0,0 +1,712 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QDebug>
+#include <QFile>
+#include <QIODevice>
+#include <QVector>
+#include <QXmlNamePool>
+
+#include <libxml/HTMLparser.h>
+#include <libxml/HTMLtree.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+#include "qlibxmlstreamextractor.h"
+#include "qlibxmlarena_p.h"
+#include "qlibxmlnodemodel_p.h"
+
+// Maximum number of steps of a path, states are bit sets of steps
+static const int MaxSteps = 64;
+
+// Attribute test of a step, the value is only compared if there is one
+struct QLibXmlStreamPredicate
+{
+    QLibXmlStreamPredicate() : hasValue(false) {}
+
+    QByteArray name;
+    QByteArray value;
+    bool hasValue;
+};
+
+// Location step of a path, a null name matches any element
+struct QLibXmlStreamStep
+{
+    QLibXmlStreamStep() : descendant(false) {}
+
+    bool descendant;
+    QByteArray name;
+    QList<QLibXmlStreamPredicate> predicates;
+};
+
+static void skipSpace(const QString &text, int *pos)
+{
+    while (*pos < text.size() && text.at(*pos).isSpace()) {
+        ++*pos;
+    }
+}
+
+// Consumes the character if it is next in the text
+static bool accept(const QString &text, int *pos, char c)
+{
+    if (*pos < text.size() && text.at(*pos) == QLatin1Char(c)) {
+        ++*pos;
+        return true;
+    }
+    return false;
+}
+
+// Consumes a name, returns an empty string if there is none
+static QString scanName(const QString &text, int *pos)
+{
+    int start = *pos;
+    while (*pos < text.size()) {
+        QChar c = text.at(*pos);
+        if (!c.isLetterOrNumber() && c != '_' && c != '-' && c != '.' && c != ':') {
+            break;
+        }
+        ++*pos;
+    }
+    return text.mid(start, *pos - start);
+}
+
+// Consumes a string literal in single or double quotes
+static bool scanLiteral(const QString &text, int *pos, QString *value)
+{
+    if (*pos >= text.size() || (text.at(*pos) != '\'' && text.at(*pos) != '"')) {
+        return false;
+    }
+    QChar quote = text.at(*pos);
+    int end = text.indexOf(quote, *pos + 1);
+    if (end < 0) {
+        return false;
+    }
+    *value = text.mid(*pos + 1, end - *pos - 1);
+    *pos = end + 1;
+    return true;
+}
+
+// Internal private data
+class QLibXmlStreamExtractorPrivate
+{
+public:
+    QXmlNamePool namePool;
+    QLibXmlNodeModel::ParseOptions options;
+
+    QString path;
+    QVector<QLibXmlStreamStep> steps;
+
+    // State of the extraction in progress
+    QUrl uri;
+    QLibXmlStreamHandler *handler;
+    xmlParserCtxtPtr ctxt;
+    bool stopped;
+    QStringList errors;
+
+    // Handlers of the parser building the tree, called for nodes which
+    // are kept
+    xmlSAXHandler sax;
+
+    // Steps which children of open elements could match, one entry per
+    // element outside of a matching subtree, the first is the document
+    QVector<quint64> states;
+
+    // Root of the matching subtree being built, if any
+    xmlNode *capture;
+
+    // Nodes below the root of a matching subtree are allocated from the
+    // arena, which is dropped once the fragment is handled. The root is
+    // built before it is known to match, it comes from the heap.
+    QLibXmlArena *arena;
+
+    QLibXmlStreamExtractorPrivate(const QXmlNamePool &namePool, const QLibXmlNodeModel::ParseOptions &options)
+        : namePool(namePool), options(options), handler(NULL), ctxt(NULL), stopped(false), capture(NULL), arena(NULL)
+    {
+        // Fragments do not outlive the parser, their names stay in the
+        // dictionary of the parser
+        this->options.dictionary = NULL;
+
+        if ((options.flags & QLibXmlNodeModel::ArenaAllocation) && QLibXmlArena::install()) {
+            arena = new QLibXmlArena;
+        }
+    }
+
+    ~QLibXmlStreamExtractorPrivate()
+    {
+        end();
+        delete arena;
+    }
+
+    // Compiles a path made of child and descendant steps with name tests
+    // and attribute predicates, such as //record[@type='book']/title.
+    // Returns false if the path is not of this form.
+    bool compile(const QString &text)
+    {
+        steps.clear();
+
+        int pos = 0;
+        skipSpace(text, &pos);
+        while (pos < text.size()) {
+            QLibXmlStreamStep step;
+            if (!accept(text, &pos, '/')) {
+                break;
+            }
+            step.descendant = accept(text, &pos, '/');
+            skipSpace(text, &pos);
+            if (!accept(text, &pos, '*')) {
+                step.name = normalizedName(scanName(text, &pos));
+                if (step.name.isEmpty()) {
+                    break;
+                }
+            }
+            skipSpace(text, &pos);
+
+            while (accept(text, &pos, '[')) {
+                QLibXmlStreamPredicate predicate;
+                skipSpace(text, &pos);
+                if (!accept(text, &pos, '@')) {
+                    break;
+                }
+                predicate.name = normalizedName(scanName(text, &pos));
+                if (predicate.name.isEmpty()) {
+                    break;
+                }
+                skipSpace(text, &pos);
+                if (accept(text, &pos, '=')) {
+                    QString value;
+                    skipSpace(text, &pos);
+                    if (!scanLiteral(text, &pos, &value)) {
+                        break;
+                    }
+                    predicate.value = value.toUtf8();
+                    predicate.hasValue = true;
+                    skipSpace(text, &pos);
+                }
+                if (!accept(text, &pos, ']')) {
+                    break;
+                }
+                skipSpace(text, &pos);
+                step.predicates.append(predicate);
+            }
+
+            steps.append(step);
+        }
+
+        if (pos < text.size() || steps.size() > MaxSteps) {
+            steps.clear();
+        }
+        return !steps.isEmpty();
+    }
+
+    // The HTML parser makes element and attribute names lower case
+    QByteArray normalizedName(const QString &name) const
+    {
+        if (options.mode == QLibXmlNodeModel::HtmlParser) {
+            return name.toLower().toUtf8();
+        }
+        return name.toUtf8();
+    }
+
+    // Returns true if the element passes the name test and predicates
+    // of the step. Names are compared without namespaces.
+    static bool matches(const QLibXmlStreamStep &step, xmlNode *element)
+    {
+        if (!step.name.isNull() && !xmlStrEqual(element->name, (const xmlChar *)step.name.constData())) {
+            return false;
+        }
+
+        for (int i = 0; i < step.predicates.size(); ++i) {
+            const QLibXmlStreamPredicate &predicate = step.predicates.at(i);
+            xmlAttr *attr = element->properties;
+            while (attr != NULL && !xmlStrEqual(attr->name, (const xmlChar *)predicate.name.constData())) {
+                attr = attr->next;
+            }
+            if (attr == NULL) {
+                return false;
+            }
+            if (predicate.hasValue) {
+                xmlChar *value = xmlNodeGetContent((xmlNode *)attr);
+                bool equal = xmlStrEqual(value ? value : BAD_CAST "", (const xmlChar *)predicate.value.constData());
+                xmlFree(value);
+                if (!equal) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Creates the push parser and routes its callbacks to this object
+    bool begin(const QUrl &documentUri, QLibXmlStreamHandler *fragmentHandler)
+    {
+        end();
+        uri = documentUri;
+        handler = fragmentHandler;
+        stopped = false;
+        errors.clear();
+        states.append(1);
+
+        if (options.mode == QLibXmlNodeModel::XmlParser) {
+            ctxt = xmlCreatePushParserCtxt(NULL, NULL, NULL, 0, uri.toString().toUtf8());
+        } else {
+            ctxt = htmlCreatePushParserCtxt(NULL, NULL, NULL, 0, uri.toString().toUtf8(), XML_CHAR_ENCODING_NONE);
+        }
+        if (ctxt == NULL) {
+            qDebug() << "could not create parser context";
+            return false;
+        }
+
+        qLibXmlUseOptions(ctxt, options);
+
+        // Ids of dropped elements would stay in the id table of the
+        // document, which then grows with the source
+        ctxt->loadsubset |= XML_SKIP_IDS;
+
+        sax = *ctxt->sax;
+        ctxt->_private = this;
+        ctxt->sax->startElement = startElement;
+        ctxt->sax->endElement = endElement;
+        ctxt->sax->startElementNs = startElementNs;
+        ctxt->sax->endElementNs = endElementNs;
+        ctxt->sax->characters = characters;
+        ctxt->sax->ignorableWhitespace = sax.ignorableWhitespace == sax.characters ? characters : ignorableWhitespace;
+        ctxt->sax->cdataBlock = cdataBlock;
+        ctxt->sax->comment = comment;
+        ctxt->sax->processingInstruction = processingInstruction;
+        ctxt->sax->reference = reference;
+
+        // HTML contexts are set up with SAX1 handlers, libxml only uses
+        // the structured error handler of SAX2 ones
+        ctxt->sax->serror = structuredError;
+        ctxt->sax->initialized = XML_SAX2_MAGIC;
+        return true;
+    }
+
+    // Parses next chunk of source, terminate finishes the document
+    void push(const char *data, int size, bool terminate)
+    {
+        if (options.mode == QLibXmlNodeModel::XmlParser) {
+            xmlParseChunk(ctxt, data, size, terminate);
+        } else {
+            htmlParseChunk(ctxt, data, size, terminate);
+        }
+    }
+
+    // Returns true if the handler or a fatal error stopped the parser
+    bool isStopped() const
+    {
+        return stopped || ctxt->disableSAX;
+    }
+
+    // Returns true if the document was parsed, XML documents have to be
+    // well-formed
+    bool isParsed() const
+    {
+        if (ctxt->myDoc == NULL) {
+            return false;
+        }
+        return options.mode == QLibXmlNodeModel::HtmlParser || ctxt->wellFormed;
+    }
+
+    // Frees the parser with what is left of the document
+    void end()
+    {
+        if (ctxt) {
+            xmlFreeDoc(ctxt->myDoc);
+            ctxt->myDoc = NULL;
+            xmlFreeParserCtxt(ctxt);
+            ctxt = NULL;
+        }
+        if (arena != NULL) {
+            arena->reset();
+        }
+        states.clear();
+        capture = NULL;
+        handler = NULL;
+    }
+
+    // Called when the default handler has created an element, which is
+    // the current node of the parser then
+    void enterElement(xmlNode *element)
+    {
+        if (capture != NULL) {
+            return;
+        }
+
+        quint64 context = states.last();
+        quint64 state = 0;
+        bool matched = false;
+        for (int i = 0; i < steps.size(); ++i) {
+            if (!(context & (Q_UINT64_C(1) << i))) {
+                continue;
+            }
+            const QLibXmlStreamStep &step = steps.at(i);
+            if (step.descendant) {
+                state |= Q_UINT64_C(1) << i;
+            }
+            if (matches(step, element)) {
+                if (i + 1 == steps.size()) {
+                    matched = true;
+                } else {
+                    state |= Q_UINT64_C(1) << (i + 1);
+                }
+            }
+        }
+
+        // Matches inside of a matching subtree are part of it
+        if (matched) {
+            capture = element;
+        } else {
+            states.append(state);
+        }
+    }
+
+    // Called when the default handler has closed an element. Elements
+    // outside of matching subtrees are freed, so only open elements and
+    // the subtree being matched are held in memory.
+    void leaveElement(xmlNode *element)
+    {
+        if (capture == NULL) {
+            if (states.size() > 1) {
+                states.pop_back();
+            }
+            xmlUnlinkNode(element);
+            xmlFreeNode(element);
+        } else if (element == capture) {
+            capture = NULL;
+            emitFragment(element);
+        }
+    }
+
+    // Moves the subtree into a document of its own and hands it to the
+    // handler as a model
+    void emitFragment(xmlNode *element)
+    {
+        xmlDoc *source = element->doc;
+        xmlUnlinkNode(element);
+
+        xmlDoc *fragment;
+        if (source->type == XML_HTML_DOCUMENT_NODE) {
+            fragment = htmlNewDocNoDtD(NULL, NULL);
+        } else {
+            fragment = xmlNewDoc(BAD_CAST "1.0");
+        }
+        if (fragment == NULL) {
+            xmlFreeNode(element);
+            return;
+        }
+
+        // Strings of the subtree could be interned in the dictionary of
+        // the parser
+        if (source->dict != NULL) {
+            fragment->dict = source->dict;
+            xmlDictReference(source->dict);
+        }
+        xmlAddChild((xmlNode *)fragment, element);
+
+        // Namespaces declared by ancestors are declared on the root
+        if (source->type != XML_HTML_DOCUMENT_NODE) {
+            xmlReconciliateNs(fragment, element);
+        }
+
+        // The model takes the dictionary and nodes as they are. Freeing
+        // the document does nothing for nodes of the arena, which is then
+        // dropped at once.
+        bool handled;
+        {
+            QLibXmlNodeModel model(namePool, fragment, uri, options);
+            handled = handler->handleFragment(model);
+        }
+        if (arena != NULL) {
+            arena->reset();
+        }
+
+        if (!handled) {
+            stopped = true;
+            xmlStopParser(ctxt);
+        }
+    }
+
+    static QLibXmlStreamExtractorPrivate *self(void *userData)
+    {
+        return (QLibXmlStreamExtractorPrivate *)((xmlParserCtxtPtr)userData)->_private;
+    }
+
+    // Makes the arena current while a handler builds a matching subtree
+    class CaptureScope : public QLibXmlArena::TreeScope
+    {
+    public:
+        explicit CaptureScope(void *userData)
+            : QLibXmlArena::TreeScope(self(userData)->capture ? self(userData)->arena : NULL,
+                                      &((xmlParserCtxtPtr)userData)->lastError)
+        {
+        }
+    };
+
+    static void startElement(void *userData, const xmlChar *name, const xmlChar **atts)
+    {
+        xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)userData;
+        xmlNode *parent = ctxt->node;
+        {
+            CaptureScope scope(userData);
+            self(userData)->sax.startElement(userData, name, atts);
+        }
+        if (ctxt->node != NULL && ctxt->node != parent) {
+            self(userData)->enterElement(ctxt->node);
+        }
+    }
+
+    static void endElement(void *userData, const xmlChar *name)
+    {
+        xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)userData;
+        xmlNode *element = ctxt->node;
+        self(userData)->sax.endElement(userData, name);
+        if (element != NULL && ctxt->node != element) {
+            self(userData)->leaveElement(element);
+        }
+    }
+
+    static void startElementNs(void *userData, const xmlChar *localName, const xmlChar *prefix,
+                               const xmlChar *uri, int namespaceCount, const xmlChar **namespaces,
+                               int attributeCount, int defaultedCount, const xmlChar **attributes)
+    {
+        xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)userData;
+        xmlNode *parent = ctxt->node;
+        {
+            CaptureScope scope(userData);
+            self(userData)->sax.startElementNs(userData, localName, prefix, uri, namespaceCount, namespaces,
+                                               attributeCount, defaultedCount, attributes);
+        }
+        if (ctxt->node != NULL && ctxt->node != parent) {
+            self(userData)->enterElement(ctxt->node);
+        }
+    }
+
+    static void endElementNs(void *userData, const xmlChar *localName, const xmlChar *prefix, const xmlChar *uri)
+    {
+        xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)userData;
+        xmlNode *element = ctxt->node;
+        self(userData)->sax.endElementNs(userData, localName, prefix, uri);
+        if (element != NULL && ctxt->node != element) {
+            self(userData)->leaveElement(element);
+        }
+    }
+
+    // Other content is only built inside of a matching subtree
+
+    static void characters(void *userData, const xmlChar *ch, int len)
+    {
+        QLibXmlStreamExtractorPrivate *d = self(userData);
+        if (d->capture != NULL && d->sax.characters != NULL) {
+            CaptureScope scope(userData);
+            d->sax.characters(userData, ch, len);
+        }
+    }
+
+    static void ignorableWhitespace(void *userData, const xmlChar *ch, int len)
+    {
+        QLibXmlStreamExtractorPrivate *d = self(userData);
+        if (d->capture != NULL && d->sax.ignorableWhitespace != NULL) {
+            CaptureScope scope(userData);
+            d->sax.ignorableWhitespace(userData, ch, len);
+        }
+    }
+
+    static void cdataBlock(void *userData, const xmlChar *value, int len)
+    {
+        QLibXmlStreamExtractorPrivate *d = self(userData);
+        if (d->capture != NULL && d->sax.cdataBlock != NULL) {
+            CaptureScope scope(userData);
+            d->sax.cdataBlock(userData, value, len);
+        }
+    }
+
+    static void comment(void *userData, const xmlChar *value)
+    {
+        QLibXmlStreamExtractorPrivate *d = self(userData);
+        if (d->capture != NULL && d->sax.comment != NULL) {
+            CaptureScope scope(userData);
+            d->sax.comment(userData, value);
+        }
+    }
+
+    static void processingInstruction(void *userData, const xmlChar *target, const xmlChar *data)
+    {
+        QLibXmlStreamExtractorPrivate *d = self(userData);
+        if (d->capture != NULL && d->sax.processingInstruction != NULL) {
+            CaptureScope scope(userData);
+            d->sax.processingInstruction(userData, target, data);
+        }
+    }
+
+    static void reference(void *userData, const xmlChar *name)
+    {
+        QLibXmlStreamExtractorPrivate *d = self(userData);
+        if (d->capture != NULL && d->sax.reference != NULL) {
+            CaptureScope scope(userData);
+            d->sax.reference(userData, name);
+        }
+    }
+
+    static void structuredError(void *userData, xmlErrorPtr error)
+    {
+        QLibXmlStreamExtractorPrivate *d = self(userData);
+        if (d != NULL) {
+            qLibXmlAddError(&d->errors, d->uri, d->options, error);
+        }
+    }
+};
+
+/*!
+ * Constructs an extractor parsing sources as described by \a options,
+ * with fragments using \a namePool. The shared dictionary of the
+ * options is not used, strings of fragments are interned by the parser.
+ * With the ArenaAllocation flag, fragments are built in one arena of the
+ * extractor, which is reused for each of them.
+ *
+ * A path has to be set by setPath() before anything is extracted.
+ */
+QLibXmlStreamExtractor::QLibXmlStreamExtractor(const QXmlNamePool &namePool, const QLibXmlNodeModel::ParseOptions &options)
+    : d(new QLibXmlStreamExtractorPrivate(namePool, options))
+{
+}
+
+/*!
+ * Destructor
+ */
+QLibXmlStreamExtractor::~QLibXmlStreamExtractor()
+{
+    delete d;
+}
+
+/*!
+ * Sets the \a path subtrees are matched by. Paths are absolute location
+ * paths of child (/) and descendant (//) steps. A step is an element
+ * name or *, followed by any number of attribute predicates, which are
+ * either [@name] or [@name='value']. For example:
+ *
+ * \code
+ * //record[@type='book']/title
+ * /html/body//div[@class='item'][@id]
+ * \endcode
+ *
+ * Names are compared without namespaces, they are made lower case for
+ * HTML. Returns false if the path is not of this form.
+ */
+bool QLibXmlStreamExtractor::setPath(const QString &path)
+{
+    d->path = path;
+    return d->compile(path);
+}
+
+/*!
+ * Returns the path set by setPath().
+ */
+QString QLibXmlStreamExtractor::path() const
+{
+    return d->path;
+}
+
+/*!
+ * Returns true if the path is valid.
+ */
+bool QLibXmlStreamExtractor::isValid() const
+{
+    return !d->steps.isEmpty();
+}
+
+/*!
+ * Parses the document read from \a device incrementally and passes each
+ * subtree matching the path to \a handler as a model of its own. The
+ * document node of the model has the matching element as its only
+ * child, and could be queried like any other model while the handler
+ * runs. Subtrees matching inside a matching subtree are not passed
+ * separately.
+ *
+ * Only the elements enclosing the current position and the subtree
+ * being matched are kept in memory, everything else is freed as soon as
+ * it is parsed. Memory used does not depend on the size of the document.
+ *
+ * Returns false if the path is not valid or the source could not be
+ * parsed. Parsing stopped by the handler is not a failure.
+ */
+bool QLibXmlStreamExtractor::extract(QIODevice *device, const QUrl &uri, QLibXmlStreamHandler *handler)
+{
+    Q_ASSERT(device);
+    Q_ASSERT(handler);
+
+    if (!isValid() || !d->begin(uri, handler)) {
+        d->end();
+        return false;
+    }
+
+    char buf[ChunkSize];
+    while (!d->isStopped()) {
+        qint64 size = device->read(buf, sizeof(buf));
+        if (size > 0) {
+            d->push(buf, size, false);
+        } else if (size < 0 || !device->waitForReadyRead(-1)) {
+            break;
+        }
+    }
+    if (!d->isStopped()) {
+        d->push(NULL, 0, true);
+    }
+
+    bool ok = d->stopped || d->isParsed();
+    d->end();
+    return ok;
+}
+
+/*!
+ * \overload
+ *
+ * Reads the document from the local file \a fileName.
+ */
+bool QLibXmlStreamExtractor::extract(const QString &fileName, QLibXmlStreamHandler *handler)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "could not open file" << fileName;
+        return false;
+    }
+    return extract(&file, QUrl::fromLocalFile(fileName), handler);
+}
+
+/*!
+ * Returns errors reported by the parser for the last document, up to
+ * the first hundred.
+ */
+QStringList QLibXmlStreamExtractor::parseErrors() const
+{
+    return d->errors;
+}
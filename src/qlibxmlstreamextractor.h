@@ -0,0 +1,77 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef QLIBXMLSTREAMEXTRACTOR_H
+#define QLIBXMLSTREAMEXTRACTOR_H
+
+#include <QStringList>
+#include <QUrl>
+
+#include "qlibxmlnodemodel.h"
+
+class QIODevice;
+class QXmlNamePool;
+class QLibXmlStreamExtractorPrivate;
+
+// Receives subtrees matched by QLibXmlStreamExtractor
+class QLibXmlStreamHandler
+{
+public:
+    virtual ~QLibXmlStreamHandler() {}
+
+    // Called for each matching subtree, in document order. The fragment
+    // is destroyed when the call returns. Returning false stops parsing.
+    virtual bool handleFragment(const QLibXmlNodeModel&) = 0;
+};
+
+class QLibXmlStreamExtractor
+{
+public:
+    explicit QLibXmlStreamExtractor(const QXmlNamePool&, const QLibXmlNodeModel::ParseOptions& = QLibXmlNodeModel::ParseOptions());
+    ~QLibXmlStreamExtractor();
+
+    bool setPath(const QString&);
+    QString path() const;
+    bool isValid() const;
+
+    bool extract(QIODevice*, const QUrl&, QLibXmlStreamHandler*);
+    bool extract(const QString&, QLibXmlStreamHandler*);
+
+    QStringList parseErrors() const;
+
+private:
+    Q_DISABLE_COPY(QLibXmlStreamExtractor)
+
+    QLibXmlStreamExtractorPrivate *d;
+};
+
+#endif // QLIBXMLSTREAMEXTRACTOR_H
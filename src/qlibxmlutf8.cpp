@@ -0,0 +1,239 @@
+/*
+ * qlibxmlnodemodel - A QAbstractXmlNodeModel for using with libxml2 library
+ * Copyright (C) 2012 Alexey Torkhov
+ * Copyright (C) 2011 Jonas Gehring
+ * All rights reserved.
+ *
+ * Based on qhtmlnodemodel by Jonas Gehring
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the copyright holders nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "qlibxmlutf8_p.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define QLIBXML_HAVE_SSE2
+#include <emmintrin.h>
+#if (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define QLIBXML_HAVE_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+// Decodes one character starting at a non-ASCII byte, advancing the
+// source and the output
+static inline void decodeSequence(const uchar *&src, const uchar *end, ushort *&out)
+{
+    uint uc = *src;
+    int length;
+    uint min;
+    if (uc >= 0xc2 && uc <= 0xdf) {
+        length = 2;
+        min = 0x80;
+        uc &= 0x1f;
+    } else if (uc >= 0xe0 && uc <= 0xef) {
+        length = 3;
+        min = 0x800;
+        uc &= 0x0f;
+    } else if (uc >= 0xf0 && uc <= 0xf4) {
+        length = 4;
+        min = 0x10000;
+        uc &= 0x07;
+    } else {
+        *out++ = QChar::ReplacementCharacter;
+        ++src;
+        return;
+    }
+
+    if (end - src < length) {
+        *out++ = QChar::ReplacementCharacter;
+        ++src;
+        return;
+    }
+    for (int i = 1; i < length; ++i) {
+        if ((src[i] & 0xc0) != 0x80) {
+            *out++ = QChar::ReplacementCharacter;
+            ++src;
+            return;
+        }
+        uc = (uc << 6) | (src[i] & 0x3f);
+    }
+
+    // Overlong forms, surrogates and characters out of range
+    if (uc < min || (uc >= 0xd800 && uc <= 0xdfff) || uc > 0x10ffff) {
+        *out++ = QChar::ReplacementCharacter;
+        ++src;
+        return;
+    }
+
+    if (uc >= 0x10000) {
+        *out++ = (uc >> 10) + 0xd7c0;
+        *out++ = (uc & 0x3ff) + 0xdc00;
+    } else {
+        *out++ = uc;
+    }
+    src += length;
+}
+
+// Decodes characters one by one from a non-ASCII one until there is a
+// run of width ASCII bytes, so vector decoders do not try a vector step
+// again after every character of mostly non-ASCII text
+static inline void decodeRun(const uchar *&src, const uchar *end, ushort *&out, int width)
+{
+    int ascii = 0;
+    while (src < end && ascii < width) {
+        if (*src < 0x80) {
+            *out++ = *src++;
+            ++ascii;
+        } else {
+            decodeSequence(src, end, out);
+            ascii = 0;
+        }
+    }
+}
+
+static int decodeScalar(const char *data, int size, ushort *out)
+{
+    const uchar *src = (const uchar *)data;
+    const uchar *end = src + size;
+    ushort *start = out;
+    while (src < end) {
+        if (*src < 0x80) {
+            *out++ = *src++;
+        } else {
+            decodeSequence(src, end, out);
+        }
+    }
+    return out - start;
+}
+
+#ifdef QLIBXML_HAVE_SSE2
+// Widens 16 ASCII bytes per step, other characters are decoded one by one
+static int decodeSse2(const char *data, int size, ushort *out)
+{
+    const uchar *src = (const uchar *)data;
+    const uchar *end = src + size;
+    ushort *start = out;
+    const __m128i zero = _mm_setzero_si128();
+    while (src < end) {
+        while (end - src >= 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i *)src);
+            int mask = _mm_movemask_epi8(chunk);
+            if (mask != 0) {
+                // Copy the ASCII prefix, then decode the character
+                int ascii = __builtin_ctz(mask);
+                for (int i = 0; i < ascii; ++i) {
+                    *out++ = *src++;
+                }
+                break;
+            }
+            _mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi8(chunk, zero));
+            _mm_storeu_si128((__m128i *)(out + 8), _mm_unpackhi_epi8(chunk, zero));
+            src += 16;
+            out += 16;
+        }
+        decodeRun(src, end, out, 16);
+    }
+    return out - start;
+}
+#endif
+
+#ifdef QLIBXML_HAVE_AVX2
+// Widens 32 ASCII bytes per step
+__attribute__((target("avx2")))
+static int decodeAvx2(const char *data, int size, ushort *out)
+{
+    const uchar *src = (const uchar *)data;
+    const uchar *end = src + size;
+    ushort *start = out;
+    while (src < end) {
+        while (end - src >= 32) {
+            __m256i chunk = _mm256_loadu_si256((const __m256i *)src);
+            uint mask = _mm256_movemask_epi8(chunk);
+            if (mask != 0) {
+                int ascii = __builtin_ctz(mask);
+                for (int i = 0; i < ascii; ++i) {
+                    *out++ = *src++;
+                }
+                break;
+            }
+            _mm256_storeu_si256((__m256i *)out, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(chunk)));
+            _mm256_storeu_si256((__m256i *)(out + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(chunk, 1)));
+            src += 32;
+            out += 32;
+        }
+        decodeRun(src, end, out, 32);
+    }
+    return out - start;
+}
+#endif
+
+typedef int (*DecodeFunction)(const char *, int, ushort *);
+
+// Picks the decoder for the CPU
+static DecodeFunction selectDecoder()
+{
+#ifdef QLIBXML_HAVE_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return decodeAvx2;
+    }
+#endif
+#ifdef QLIBXML_HAVE_SSE2
+    return decodeSse2;
+#else
+    return decodeScalar;
+#endif
+}
+
+// Returns the decoder picked on the first call, which could come from
+// a static initializer of another file, so it is not picked by one
+static DecodeFunction decoder()
+{
+    static const DecodeFunction function = selectDecoder();
+    return function;
+}
+
+int qLibXmlDecodeUtf8(const char *data, int size, ushort *out)
+{
+    return decoder()(data, size, out);
+}
+
+QString qLibXmlFromUtf8(const char *data, int size)
+{
+    if (data == NULL) {
+        return QString();
+    }
+    if (size < 0) {
+        size = strlen(data);
+    }
+
+    // Never more units than bytes
+    QString result;
+    result.resize(size);
+    result.resize(decoder()(data, size, (ushort *)result.data()));
+    return result;
+}